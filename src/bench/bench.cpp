@@ -0,0 +1,295 @@
+// Synthetic benchmark of the bake, validation & compression paths, needs no input files.
+#include <cmath>
+#include <cstring>
+#include <numbers>
+#include <random>
+
+#include <argparse/argparse.hpp>
+
+#include "lib/baker.h"
+
+using namespace std::literals;
+
+namespace {
+struct BenchArguments {
+    uint32_t size       = 512;
+    uint32_t lights     = 16;
+    uint32_t iterations = 10;
+    uint32_t seed       = 1;
+    bool     validation = false;
+};
+
+// a few octaves of value noise in [0, 1], smooth like a cloud rather than white noise
+DirectX::ScratchImage makeNoiseImage(uint32_t size, std::mt19937& rng)
+{
+    DirectX::ScratchImage image;
+    DX::ThrowIfFailed(image.Initialize2D(DXGI_FORMAT_R32_FLOAT, size, size, 1, 1));
+    std::memset(image.GetPixels(), 0, image.GetPixelsSize());
+
+    const auto* img    = image.GetImage(0, 0, 0);
+    auto        sample = std::uniform_real_distribution<float>(0.F, 1.F);
+
+    for (uint32_t octave = 0; octave < 4; ++octave) {
+        const uint32_t     cells     = 4U << octave;
+        const float        amplitude = 0.5F / static_cast<float>(1U << octave);
+        std::vector<float> lattice((cells + 1) * (cells + 1));
+        for (auto& value : lattice)
+            value = sample(rng);
+
+        for (uint32_t y = 0; y < size; ++y) {
+            auto* row = reinterpret_cast<float*>(img->pixels + (y * img->rowPitch));
+            for (uint32_t x = 0; x < size; ++x) {
+                const float fx = static_cast<float>(x) * static_cast<float>(cells) / static_cast<float>(size);
+                const float fy = static_cast<float>(y) * static_cast<float>(cells) / static_cast<float>(size);
+                const auto  cx = static_cast<uint32_t>(fx);
+                const auto  cy = static_cast<uint32_t>(fy);
+                const float tx = fx - static_cast<float>(cx);
+                const float ty = fy - static_cast<float>(cy);
+
+                const auto at   = [&](uint32_t i, uint32_t j) { return lattice[(j * (cells + 1)) + i]; };
+                const auto top  = std::lerp(at(cx, cy), at(cx + 1, cy), tx);
+                const auto down = std::lerp(at(cx, cy + 1), at(cx + 1, cy + 1), tx);
+                row[x] += amplitude * std::lerp(top, down, ty);
+            }
+        }
+    }
+    return image;
+}
+
+// evenly spread over the sphere
+DirectX::XMFLOAT3 fibonacciDirection(uint32_t i, uint32_t count)
+{
+    const float z     = 1.F - ((2.F * (static_cast<float>(i) + .5F)) / static_cast<float>(count));
+    const float r     = std::sqrt(std::max(0.F, 1.F - (z * z)));
+    const float theta = std::numbers::pi_v<float> * (3.F - std::sqrt(5.F)) * static_cast<float>(i);
+    return {r * std::cos(theta), r * std::sin(theta), z};
+}
+
+void waitForGpu(D3dObjs& d3d)
+{
+    D3D11_QUERY_DESC     desc  = {.Query = D3D11_QUERY_EVENT, .MiscFlags = 0};
+    com_ptr<ID3D11Query> query = nullptr;
+    DX::ThrowIfFailed(d3d.device->CreateQuery(&desc, query.put()));
+
+    d3d.context->End(query.get());
+    BOOL done = FALSE;
+    while (d3d.context->GetData(query.get(), &done, sizeof(done), 0) == S_FALSE)
+        std::this_thread::yield();
+}
+
+// seconds for `iterations` calls of run(), the gpu is drained before and after
+template <typename Run>
+double timeGpu(D3dObjs& d3d, uint32_t iterations, Run&& run)
+{
+    run(); // warm up
+    waitForGpu(d3d);
+
+    const auto start = Profiler::Clock::now();
+    for (uint32_t i = 0; i < iterations; ++i)
+        run();
+    waitForGpu(d3d);
+    return Profiler::msSince(start) / 1000.0;
+}
+} // namespace
+
+
+int main(int argc, char* argv[])
+{
+    Arguments      args;
+    BenchArguments bench;
+    D3dObjs        d3d{};
+
+    // Arg parse
+    {
+        argparse::ArgumentParser program("cloud-bakery-bench");
+        program.add_argument("--size")
+            .help("Face size of the synthetic set, a multiple of 4.")
+            .default_value(512)
+            .scan<'i', int>();
+        program.add_argument("--lights")
+            .help("Number of light directions of the synthetic set.")
+            .default_value(16)
+            .scan<'i', int>();
+        program.add_argument("--iterations")
+            .help("Timed iterations of every path, after one warm up.")
+            .default_value(10)
+            .scan<'i', int>();
+        program.add_argument("--seed")
+            .help("Seed of the synthetic inputs.")
+            .default_value(1)
+            .scan<'i', int>();
+        program.add_argument("-b", "--batched")
+            .help("Bake all light directions in a single dispatch.")
+            .flag();
+        program.add_argument("--sh-format")
+            .help("Storage of the SH coefficients, \"f32\" or \"f16\" (requires --batched).")
+            .default_value("f32"s);
+        program.add_argument("--sh-order")
+            .help("Order of the baked SH, 1 or 2.")
+            .default_value(2)
+            .scan<'i', int>();
+        program.add_argument("--compressor")
+            .help("BC6H compressor to time, \"cpu\" or \"gpu\".")
+            .default_value("cpu"s);
+        program.add_argument("--validation")
+            .help("Also run the all-lights validation of --validate after every bake.")
+            .flag();
+        program.add_argument("--phase-lut")
+            .help("Read view directions & the phase function from lookup tables.")
+            .flag();
+        program.add_argument("--shader-dir")
+            .help("Compile shaders from the sources in this directory instead of using the embedded bytecode.")
+            .default_value(std::string{});
+
+        try {
+            program.parse_args(argc, argv);
+        } catch (const std::exception& err) {
+            spdlog::error("Error while parsing arguments:\n"
+                          "{}",
+                          err.what());
+            return E_INVALIDARG;
+        }
+
+        bench.size       = static_cast<uint32_t>(std::max(4, program.get<int>("--size")));
+        bench.lights     = static_cast<uint32_t>(std::max(1, program.get<int>("--lights")));
+        bench.iterations = static_cast<uint32_t>(std::max(1, program.get<int>("--iterations")));
+        bench.seed       = static_cast<uint32_t>(program.get<int>("--seed"));
+        bench.validation = program.get<bool>("--validation");
+        if (bench.size % 4 != 0) {
+            spdlog::error("Size must be a multiple of 4");
+            return E_INVALIDARG;
+        }
+        if (bench.lights > D3D11_REQ_TEXTURE2D_ARRAY_AXIS_DIMENSION) {
+            spdlog::error("At most {} lights fit in a texture array", D3D11_REQ_TEXTURE2D_ARRAY_AXIS_DIMENSION);
+            return E_INVALIDARG;
+        }
+
+        const auto compressor = program.get("--compressor");
+        if (compressor != "cpu" && compressor != "gpu") {
+            spdlog::error("Invalid compressor: {}", compressor);
+            return E_INVALIDARG;
+        }
+
+        args.batched        = program.get<bool>("-b");
+        args.gpu_compressor = compressor == "gpu";
+        args.phase_lut      = program.get<bool>("--phase-lut");
+        args.shader_dir     = program.get("--shader-dir");
+        args.validate       = bench.validation;
+
+        const auto sh_format = program.get("--sh-format");
+        if (sh_format == "f16" && !args.batched) {
+            spdlog::error("--sh-format f16 requires --batched");
+            return E_INVALIDARG;
+        }
+        args.sh_format = (sh_format == "f16") ? DXGI_FORMAT_R16G16B16A16_FLOAT : DXGI_FORMAT_R32G32B32A32_FLOAT;
+
+        const auto sh_order = program.get<int>("--sh-order");
+        if (sh_order != 1 && sh_order != 2) {
+            spdlog::error("Invalid SH order: {}", sh_order);
+            return E_INVALIDARG;
+        }
+        args.sh_order = static_cast<uint32_t>(sh_order);
+    }
+
+    {
+        HRESULT hr = initDevice(d3d);
+        if (SUCCEEDED(hr))
+            hr = initShaders(d3d, args);
+        if (FAILED(hr))
+            return hr;
+    }
+
+    // Synthetic set
+    InputTexSet tex_set{.face = 0};
+    {
+        std::mt19937 rng(bench.seed);
+
+        const auto tr_image = makeNoiseImage(bench.size, rng);
+        DX::ThrowIfFailed(DirectX::CreateShaderResourceView(d3d.device.get(), tr_image.GetImages(), tr_image.GetImageCount(), tr_image.GetMetadata(), tex_set.tr.srv.put()));
+
+        std::vector<DirectX::ScratchImage> color_images;
+        for (uint32_t i = 0; i < bench.lights; ++i) {
+            color_images.push_back(makeNoiseImage(bench.size, rng));
+            tex_set.colors.push_back({
+                .light_direction = fibonacciDirection(i, bench.lights),
+                .width           = bench.size,
+                .height          = bench.size,
+                .format          = DXGI_FORMAT_R32_FLOAT,
+            });
+        }
+        DX::ThrowIfFailed(initColorArray(d3d.device.get(), color_images, tex_set.colors_tex, tex_set.colors_srv));
+    }
+
+    BakeJob job{
+        .key = "bench",
+        .cb_data{
+            .weight    = 1.F / static_cast<float>(bench.lights),
+            .face      = tex_set.face,
+            .face_dims = {bench.size, bench.size},
+        },
+        .colors     = tex_set.colors,
+        .colors_srv = tex_set.colors_srv.get(),
+        .tr_srv     = tex_set.tr.srv.get(),
+        .cb         = d3d.common_buffer.get(),
+        .width      = bench.size,
+        .height     = bench.size,
+    };
+    job.sh_coeffs = acquireTex<true>(d3d, bench.size, bench.size, args.sh_format, shSlices(args.sh_order));
+
+    spdlog::info("{} x {}, {} lights, L{}, {}{}{}{}, {} iterations",
+                 bench.size, bench.size, bench.lights, args.sh_order, args.batched ? "batched" : "per light",
+                 (args.sh_format == DXGI_FORMAT_R16G16B16A16_FLOAT) ? ", f16" : ", f32", args.phase_lut ? ", phase lut" : "", bench.validation ? ", validation" : "", bench.iterations);
+
+    // Bake
+    {
+        const auto seconds = timeGpu(d3d, bench.iterations, [&]() {
+            float values[4] = {0, 0, 0, 0};
+            d3d.context->ClearUnorderedAccessViewFloat(job.sh_coeffs.uav.get(), values);
+            dispatchBake(d3d, args.batched, {&job, 1});
+            if (bench.validation) {
+                dispatchValidationStats(d3d, job);
+                // the stats are not read back, their staging buffers are reused like once resolved
+                for (auto& pending : d3d.pending_validations)
+                    d3d.validation_staging.push_back(std::move(pending.staging));
+                d3d.pending_validations.clear();
+            }
+        });
+
+        const double texel_lights = static_cast<double>(bench.size) * bench.size * bench.lights * bench.iterations;
+        spdlog::info("bake{}: {:.3f} ms per iteration, {:.3f} Gtexel-lights/s",
+                     bench.validation ? " + validation" : "", seconds * 1000.0 / bench.iterations, texel_lights / seconds / 1e9);
+    }
+
+    // Compression, throughput is of the uncompressed sh coefficients
+    {
+        const double sh_bytes = static_cast<double>(bench.size) * bench.size * shSlices(args.sh_order) * DirectX::BitsPerPixel(args.sh_format) / 8;
+
+        double seconds = 0;
+        if (args.gpu_compressor) {
+            auto block_tex = acquireBC6HBlockTex(d3d, bench.size, bench.size, shSlices(args.sh_order));
+            seconds        = timeGpu(d3d, bench.iterations, [&]() { dispatchBC6H(d3d, job.sh_coeffs.srv.get(), block_tex.uav.get(), bench.size, bench.size, shSlices(args.sh_order)); });
+            d3d.tex_pool.release(std::move(block_tex));
+        } else {
+            DirectX::ScratchImage sh_image;
+            DX::ThrowIfFailed(readbackTex(d3d, job.sh_coeffs.tex.get(), sh_image));
+
+            const auto compress = [&]() {
+                DirectX::ScratchImage blocks;
+                DX::ThrowIfFailed(DirectX::Compress(sh_image.GetImages(), sh_image.GetImageCount(), sh_image.GetMetadata(),
+                                                    DXGI_FORMAT_BC6H_SF16, DirectX::TEX_COMPRESS_DEFAULT, 1.0F, blocks));
+            };
+            compress(); // warm up
+
+            const auto start = Profiler::Clock::now();
+            for (uint32_t i = 0; i < bench.iterations; ++i)
+                compress();
+            seconds = Profiler::msSince(start) / 1000.0;
+            d3d.readback_pools.images.release(std::move(sh_image));
+        }
+
+        spdlog::info("compress ({}): {:.3f} ms per iteration, {:.1f} MB/s",
+                     args.gpu_compressor ? "gpu" : "cpu", seconds * 1000.0 / bench.iterations, sh_bytes * bench.iterations / seconds / 1e6);
+    }
+
+    return S_OK;
+}
@@ -0,0 +1,2422 @@
+#include "lib/baker.h"
+
+#include <cassert>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <future>
+#include <limits>
+#include <ranges>
+
+#include <immintrin.h>
+
+#include <d3dcompiler.h>
+
+// bytecode generated by the hlsl.cso rule in xmake.lua
+#include "BC6H.cs.h"
+#include "Bake.cs.h"
+#include "Bake_BATCHED.cs.h"
+#include "Bake_BATCHED_FACES.cs.h"
+#include "Bake_BATCHED_FACES_L1.cs.h"
+#include "Bake_BATCHED_FACES_TILED_L1_SM6.cs.h"
+#include "Bake_BATCHED_FACES_TILED_SM6.cs.h"
+#include "Bake_BATCHED_L1.cs.h"
+#include "Bake_BATCHED_LUT.cs.h"
+#include "Bake_BATCHED_LUT_L1.cs.h"
+#include "Bake_BATCHED_TILED_L1_SM6.cs.h"
+#include "Bake_BATCHED_TILED_SM6.cs.h"
+#include "Bake_L1.cs.h"
+#include "Bake_LUT.cs.h"
+#include "Bake_LUT_L1.cs.h"
+#include "Validation.cs.h"
+#include "ValidationReduce.cs.h"
+#include "Validation_ALL.cs.h"
+#include "Validation_LUT.cs.h"
+
+namespace {
+// blobs are cached in the temp dir, keyed by the source, every .hlsli next to it, the entry point and defines
+com_ptr<ID3DBlob> compileShader(const std::filesystem::path& path, const char* entry_point, const D3D_SHADER_MACRO* defines = nullptr)
+{
+    constexpr auto COMPILE_FLAGS = D3DCOMPILE_ENABLE_STRICTNESS | D3DCOMPILE_OPTIMIZATION_LEVEL3;
+
+    if (!std::filesystem::exists(path)) {
+        spdlog::error("Failed to compile shader: {} does not exist", path.string());
+        return nullptr;
+    }
+
+    std::vector<std::filesystem::path> includes;
+    for (auto const& entry : std::filesystem::directory_iterator(path.parent_path()))
+        if (entry.path().extension() == ".hlsli")
+            includes.push_back(entry.path());
+    std::ranges::sort(includes);
+
+    uint64_t hash = hashBytes(readFile(path));
+    for (auto const& include : includes)
+        hash = hashBytes(readFile(include), hash);
+    hash = hashBytes(std::format("{}|cs_5_0|{}", entry_point, COMPILE_FLAGS), hash);
+    for (const auto* define = defines; (define != nullptr) && (define->Name != nullptr); ++define)
+        hash = hashBytes(std::format("|{}={}", define->Name, define->Definition), hash);
+
+    const auto cache_dir  = std::filesystem::temp_directory_path() / "cloud-bakery-shaders";
+    const auto cache_path = cache_dir / std::format("{}_{:016x}.cso", path.stem().string(), hash);
+
+    com_ptr<ID3DBlob> shader_blob = nullptr;
+    if (std::filesystem::exists(cache_path) && SUCCEEDED(D3DReadFileToBlob(cache_path.wstring().c_str(), shader_blob.put()))) {
+        spdlog::info("Loaded {} :{} from cache", path.string(), entry_point);
+        return shader_blob;
+    }
+
+    spdlog::info("Compiling {} :{} ...", path.string(), entry_point);
+
+    com_ptr<ID3DBlob> shader_errors = nullptr;
+    if (FAILED(D3DCompileFromFile(path.wstring().c_str(), defines, D3D_COMPILE_STANDARD_FILE_INCLUDE,
+                                  entry_point, "cs_5_0", COMPILE_FLAGS, 0, shader_blob.put(), shader_errors.put()))) {
+        spdlog::error("Shader compilation failed:\n\n{}", shader_errors ? static_cast<char*>(shader_errors->GetBufferPointer()) : "Unknown error");
+        return nullptr;
+    }
+
+    // a failed cache write only costs a recompile next time
+    std::error_code ec;
+    std::filesystem::create_directories(cache_dir, ec);
+    if (FAILED(D3DWriteBlobToFile(shader_blob.get(), cache_path.wstring().c_str(), TRUE)))
+        spdlog::warn("Failed to cache shader blob at {}", cache_path.string());
+
+    return shader_blob;
+}
+
+// embedded bytecode, or compiled from shader_dir if given, see --shader-dir
+// the bytecode used gets folded into bytecode_hash, shader_blob keeps compiled bytecode alive, empty on failure
+std::span<const BYTE> shaderBytecode(const std::filesystem::path& shader_dir,
+                                     const char*                  filename,
+                                     std::span<const BYTE>        bytecode,
+                                     uint64_t&                    bytecode_hash,
+                                     const D3D_SHADER_MACRO*      defines,
+                                     com_ptr<ID3DBlob>&           shader_blob)
+{
+    if (!shader_dir.empty()) {
+        shader_blob = compileShader(shader_dir / filename, "main", defines);
+        if (!shader_blob)
+            return {};
+        bytecode = {static_cast<const BYTE*>(shader_blob->GetBufferPointer()), shader_blob->GetBufferSize()};
+    }
+    bytecode_hash = hashBytes({reinterpret_cast<const char*>(bytecode.data()), bytecode.size()}, bytecode_hash);
+    return bytecode;
+}
+
+ID3D11ComputeShader* loadShader(ID3D11Device*                device,
+                                const std::filesystem::path& shader_dir,
+                                const char*                  filename,
+                                std::span<const BYTE>        bytecode,
+                                uint64_t&                    bytecode_hash,
+                                const D3D_SHADER_MACRO*      defines = nullptr)
+{
+    com_ptr<ID3DBlob> shader_blob = nullptr;
+    bytecode                      = shaderBytecode(shader_dir, filename, bytecode, bytecode_hash, defines, shader_blob);
+    if (bytecode.empty())
+        return nullptr;
+
+    ID3D11ComputeShader* reg_shader = nullptr;
+    if (FAILED(device->CreateComputeShader(bytecode.data(), bytecode.size(), nullptr, &reg_shader))) {
+        spdlog::error("Failed to create compute shader from {}", filename);
+        return nullptr;
+    }
+    return reg_shader;
+}
+
+// R32G32B32A32_UINT blocks for BC6H.cs.hlsl, one texel per 4x4 block of each sh slice
+ShTexture initBC6HBlockTex(ID3D11Device* device, uint32_t width, uint32_t height, uint32_t sh_slices = 3)
+{
+    ShTexture retval;
+
+    D3D11_TEXTURE2D_DESC tex_desc = {
+        .Width          = (width + 3) / 4,
+        .Height         = (height + 3) / 4,
+        .MipLevels      = 1,
+        .ArraySize      = sh_slices,
+        .Format         = DXGI_FORMAT_R32G32B32A32_UINT,
+        .SampleDesc     = {.Count = 1, .Quality = 0},
+        .Usage          = D3D11_USAGE_DEFAULT,
+        .BindFlags      = D3D11_BIND_UNORDERED_ACCESS,
+        .CPUAccessFlags = 0,
+        .MiscFlags      = 0,
+    };
+
+    D3D11_UNORDERED_ACCESS_VIEW_DESC uav_desc = {
+        .Format         = tex_desc.Format,
+        .ViewDimension  = D3D11_UAV_DIMENSION_TEXTURE2DARRAY,
+        .Texture2DArray = {.MipSlice = 0, .FirstArraySlice = 0, .ArraySize = tex_desc.ArraySize},
+    };
+
+    DX::ThrowIfFailed(device->CreateTexture2D(&tex_desc, nullptr, retval.tex.put()));
+    DX::ThrowIfFailed(device->CreateUnorderedAccessView(retval.tex.get(), &uav_desc, retval.uav.put()));
+
+    return retval;
+}
+} // namespace
+
+ShTexture acquireBC6HBlockTex(D3dObjs& d3d, uint32_t width, uint32_t height, uint32_t sh_slices)
+{
+    return d3d.tex_pool.acquire((width + 3) / 4, (height + 3) / 4, sh_slices, DXGI_FORMAT_R32G32B32A32_UINT, [&]() { return initBC6HBlockTex(d3d.device.get(), width, height, sh_slices); });
+}
+
+namespace {
+BatchedInputs initBatchedInputs(ID3D11Device* device, std::span<const InputTexture> colors)
+{
+    BatchedInputs retval;
+
+    const auto light_count = static_cast<uint32_t>(colors.size());
+
+    // w is how many colors the light stands for, see --dedup
+    std::vector<DirectX::XMFLOAT4> light_dirs;
+    light_dirs.reserve(light_count);
+    for (auto const& entry : colors)
+        light_dirs.push_back({entry.light_direction.x, entry.light_direction.y, entry.light_direction.z, static_cast<float>(entry.count)});
+
+    D3D11_BUFFER_DESC buf_desc = {
+        .ByteWidth           = static_cast<UINT>(sizeof(DirectX::XMFLOAT4) * light_count),
+        .Usage               = D3D11_USAGE_IMMUTABLE,
+        .BindFlags           = D3D11_BIND_SHADER_RESOURCE,
+        .CPUAccessFlags      = 0,
+        .MiscFlags           = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED,
+        .StructureByteStride = sizeof(DirectX::XMFLOAT4),
+    };
+    D3D11_SUBRESOURCE_DATA buf_data = {.pSysMem = light_dirs.data()};
+    DX::ThrowIfFailed(device->CreateBuffer(&buf_desc, &buf_data, retval.light_dirs.put()));
+
+    D3D11_SHADER_RESOURCE_VIEW_DESC buf_srv_desc = {
+        .Format        = DXGI_FORMAT_UNKNOWN,
+        .ViewDimension = D3D11_SRV_DIMENSION_BUFFER,
+        .Buffer        = {.FirstElement = 0, .NumElements = light_count},
+    };
+    DX::ThrowIfFailed(device->CreateShaderResourceView(retval.light_dirs.get(), &buf_srv_desc, retval.light_dirs_srv.put()));
+
+    return retval;
+}
+
+// Ports of the shader math, for the cpu backend & the lookup tables of --phase-lut
+
+constexpr float SHADER_PI = 3.1415926F; // as written in the shaders
+
+// Phase::MsHeuristic, constant parts folded
+constexpr float PHASE_SCALE   = .25F / SHADER_PI;
+constexpr float HG_G          = 0.9882F;
+constexpr float HG_NUM        = PHASE_SCALE * (1.F - (HG_G * HG_G));
+constexpr float DRAINE_G      = 0.5557F;
+constexpr float DRAINE_ALPHA  = 21.9955F;
+constexpr float DRAINE_NUM    = PHASE_SCALE * (1.F - (DRAINE_G * DRAINE_G)) / (1.F + (DRAINE_ALPHA * (1.F + (2.F * DRAINE_G * DRAINE_G)) / 3.F));
+constexpr float DRAINE_WEIGHT = 0.4820F;
+
+// iso_weight = 1 - pow(tr, .5)
+float msHeuristicPhase(float cos_theta, float iso_weight)
+{
+    const auto denom = [cos_theta](float g) {
+        const float t = std::abs(1.F + (g * g) - (2.F * g * cos_theta));
+        return t * std::sqrt(t);
+    };
+    const float hg        = HG_NUM / denom(HG_G);
+    const float draine    = DRAINE_NUM * (1.F + (DRAINE_ALPHA * cos_theta * cos_theta)) / denom(DRAINE_G);
+    const float jendersie = hg + (DRAINE_WEIGHT * (draine - hg));
+    return jendersie + (iso_weight * (PHASE_SCALE - jendersie));
+}
+
+#ifdef __AVX2__
+__m256 msHeuristicPhase(__m256 cos_theta, __m256 iso_weight)
+{
+    const __m256 one  = _mm256_set1_ps(1.F);
+    const __m256 sign = _mm256_set1_ps(-0.F);
+
+    const auto denom = [&](float g) {
+        const __m256 t = _mm256_andnot_ps(sign, _mm256_sub_ps(_mm256_set1_ps(1.F + (g * g)), _mm256_mul_ps(_mm256_set1_ps(2.F * g), cos_theta)));
+        return _mm256_mul_ps(t, _mm256_sqrt_ps(t));
+    };
+    const __m256 hg        = _mm256_div_ps(_mm256_set1_ps(HG_NUM), denom(HG_G));
+    const __m256 lobe      = _mm256_add_ps(one, _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(DRAINE_ALPHA), cos_theta), cos_theta));
+    const __m256 draine    = _mm256_div_ps(_mm256_mul_ps(_mm256_set1_ps(DRAINE_NUM), lobe), denom(DRAINE_G));
+    const __m256 jendersie = _mm256_add_ps(hg, _mm256_mul_ps(_mm256_set1_ps(DRAINE_WEIGHT), _mm256_sub_ps(draine, hg)));
+    return _mm256_add_ps(jendersie, _mm256_mul_ps(iso_weight, _mm256_sub_ps(_mm256_set1_ps(PHASE_SCALE), jendersie)));
+}
+#endif
+
+// SH::ProjectOntoL2
+std::array<float, 9> projectOntoL2(const DirectX::XMFLOAT3& dir, float value)
+{
+    static const float SQRT_PI = std::sqrt(3.141592654F);
+
+    const float l0     = 1.F / (2.F * SQRT_PI);
+    const float l1     = std::sqrt(3.F) / (2.F * SQRT_PI);
+    const float l2_mn2 = std::sqrt(15.F) / (2.F * SQRT_PI);
+    const float l2_m0  = std::sqrt(5.F) / (4.F * SQRT_PI);
+    const float l2_m2  = std::sqrt(15.F) / (4.F * SQRT_PI);
+    return {
+        l0 * value,
+        l1 * dir.y * value,
+        l1 * dir.z * value,
+        l1 * dir.x * value,
+        l2_mn2 * dir.x * dir.y * value,
+        l2_mn2 * dir.y * dir.z * value,
+        l2_m0 * ((3.F * dir.z * dir.z) - 1.F) * value,
+        l2_mn2 * dir.x * dir.z * value,
+        l2_m2 * ((dir.x * dir.x) - (dir.y * dir.y)) * value,
+    };
+}
+
+// viewDirFromFace, face_pos = tan((uv - .5) * .5 * pi) * .5
+DirectX::XMFLOAT3 viewDirFromFace(uint32_t face, float face_pos_x, float face_pos_y)
+{
+    DirectX::XMFLOAT3 view_dir;
+    switch (face) {
+        case 0: view_dir = {0.5F, -face_pos_x, -face_pos_y}; break;
+        case 1: view_dir = {-0.5F, face_pos_x, -face_pos_y}; break;
+        case 2: view_dir = {face_pos_x, 0.5F, -face_pos_y}; break;
+        case 3: view_dir = {-face_pos_x, -0.5F, -face_pos_y}; break;
+        case 4: view_dir = {-face_pos_x, -face_pos_y, 0.5F}; break;
+        default: view_dir = {1.F, 0.F, 0.F}; break;
+    }
+    DirectX::XMStoreFloat3(&view_dir, DirectX::XMVector3Normalize(DirectX::XMLoadFloat3(&view_dir)));
+    return view_dir;
+}
+
+float faceTan(uint32_t texel, uint32_t size)
+{
+    const float uv = (static_cast<float>(texel) + .5F) / static_cast<float>(size);
+    return std::tan((uv - .5F) * .5F * SHADER_PI) * .5F;
+}
+
+constexpr uint32_t JENDERSIE_LUT_SIZE = 4096; // as in Common.hlsli
+
+// as Phase::JendersieFromLut
+float sampleJendersieLut(std::span<const float> lut, float cos_theta)
+{
+    const float x = std::sqrt(std::clamp(.5F - (.5F * cos_theta), 0.F, 1.F)) * static_cast<float>(JENDERSIE_LUT_SIZE - 1);
+    const auto  i = std::min(static_cast<uint32_t>(x), JENDERSIE_LUT_SIZE - 2);
+    return lut[i] + ((x - static_cast<float>(i)) * (lut[i + 1] - lut[i]));
+}
+
+// JendersieAt10um over sqrt((1 - cos_theta) / 2), bound for the LUT variants of the bake & validation kernels
+HRESULT initPhaseLut(D3dObjs& d3d)
+{
+    std::vector<float> lut(JENDERSIE_LUT_SIZE);
+    for (uint32_t i = 0; i < JENDERSIE_LUT_SIZE; ++i) {
+        const float s = static_cast<float>(i) / static_cast<float>(JENDERSIE_LUT_SIZE - 1);
+        lut[i]        = msHeuristicPhase(1.F - (2.F * s * s), 0.F);
+    }
+
+    // worst case is between entries, the tr blend after the lookup is exact
+    constexpr uint32_t STEPS   = 8;
+    float              max_err = 0.F;
+    for (uint32_t i = 0; i < (JENDERSIE_LUT_SIZE - 1) * STEPS; ++i) {
+        const float s         = static_cast<float>(i) / static_cast<float>((JENDERSIE_LUT_SIZE - 1) * STEPS);
+        const float cos_theta = 1.F - (2.F * s * s);
+        const float exact     = msHeuristicPhase(cos_theta, 0.F);
+        max_err               = std::max(max_err, std::abs((sampleJendersieLut(lut, cos_theta) / exact) - 1.F));
+    }
+    spdlog::info("Phase LUT: {} entries, max relative error {:.2e}", JENDERSIE_LUT_SIZE, max_err);
+
+    D3D11_BUFFER_DESC buf_desc = {
+        .ByteWidth           = static_cast<UINT>(sizeof(float) * lut.size()),
+        .Usage               = D3D11_USAGE_IMMUTABLE,
+        .BindFlags           = D3D11_BIND_SHADER_RESOURCE,
+        .CPUAccessFlags      = 0,
+        .MiscFlags           = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED,
+        .StructureByteStride = sizeof(float),
+    };
+    D3D11_SUBRESOURCE_DATA init_data = {.pSysMem = lut.data(), .SysMemPitch = 0, .SysMemSlicePitch = 0};
+    com_ptr<ID3D11Buffer>  buffer    = nullptr;
+    HRESULT                hr        = d3d.device->CreateBuffer(&buf_desc, &init_data, buffer.put());
+    if (FAILED(hr))
+        return hr;
+
+    D3D11_SHADER_RESOURCE_VIEW_DESC srv_desc = {
+        .Format        = DXGI_FORMAT_UNKNOWN,
+        .ViewDimension = D3D11_SRV_DIMENSION_BUFFER,
+        .Buffer        = {.FirstElement = 0, .NumElements = JENDERSIE_LUT_SIZE},
+    };
+    return d3d.device->CreateShaderResourceView(buffer.get(), &srv_desc, d3d.phase_lut_srv.put());
+}
+
+constexpr size_t VIEW_DIR_LUT_CACHE = 5; // one per face
+
+// view directions of the width x height region at offset of a face, a whole face unless tiled, built on first use
+// the cache starts over once it holds VIEW_DIR_LUT_CACHE, so tiles do not add up to faces
+ID3D11ShaderResourceView* viewDirLut(D3dObjs& d3d, uint32_t face, const DirectX::XMUINT2& face_dims, const DirectX::XMUINT2& offset, uint32_t width, uint32_t height)
+{
+    const std::array<uint32_t, 7> key = {face, face_dims.x, face_dims.y, offset.x, offset.y, width, height};
+    if (auto it = d3d.view_dir_luts.find(key); it != d3d.view_dir_luts.end())
+        return it->second.get();
+    if (d3d.view_dir_luts.size() >= VIEW_DIR_LUT_CACHE)
+        d3d.view_dir_luts.clear(); // the gpu keeps those still in use alive
+    auto& srv = d3d.view_dir_luts[key];
+
+    std::vector<float> face_pos_x(width);
+    for (uint32_t x = 0; x < width; ++x)
+        face_pos_x[x] = faceTan(offset.x + x, face_dims.x);
+
+    std::vector<DirectX::XMFLOAT4> view_dirs(size_t{width} * height);
+    parallelFor(height, std::max(1U, std::thread::hardware_concurrency()), [&](size_t y) {
+        const auto face_pos_y = faceTan(offset.y + static_cast<uint32_t>(y), face_dims.y);
+        for (uint32_t x = 0; x < width; ++x) {
+            const auto view_dir          = viewDirFromFace(face, face_pos_x[x], face_pos_y);
+            view_dirs[(y * width) + x] = {view_dir.x, view_dir.y, view_dir.z, 0.F};
+        }
+    });
+
+    D3D11_TEXTURE2D_DESC tex_desc = {
+        .Width          = width,
+        .Height         = height,
+        .MipLevels      = 1,
+        .ArraySize      = 1,
+        .Format         = DXGI_FORMAT_R32G32B32A32_FLOAT, // f16 is too coarse for the forward peak
+        .SampleDesc     = {.Count = 1, .Quality = 0},
+        .Usage          = D3D11_USAGE_IMMUTABLE,
+        .BindFlags      = D3D11_BIND_SHADER_RESOURCE,
+        .CPUAccessFlags = 0,
+        .MiscFlags      = 0,
+    };
+    D3D11_SUBRESOURCE_DATA   init_data = {.pSysMem = view_dirs.data(), .SysMemPitch = static_cast<UINT>(sizeof(DirectX::XMFLOAT4) * width), .SysMemSlicePitch = 0};
+    com_ptr<ID3D11Texture2D> tex       = nullptr;
+    DX::ThrowIfFailed(d3d.device->CreateTexture2D(&tex_desc, &init_data, tex.put()));
+    DX::ThrowIfFailed(d3d.device->CreateShaderResourceView(tex.get(), nullptr, srv.put()));
+    return srv.get();
+}
+
+HRESULT initConstantBuffer(ID3D11Device* device, com_ptr<ID3D11Buffer>& buffer)
+{
+    D3D11_BUFFER_DESC desc = {
+        .ByteWidth      = (sizeof(BakeCBData) + (64 - 1)) & ~(64 - 1),
+        .Usage          = D3D11_USAGE_DEFAULT,
+        .BindFlags      = D3D11_BIND_CONSTANT_BUFFER,
+        .CPUAccessFlags = 0,
+    };
+    return device->CreateBuffer(&desc, nullptr, buffer.put());
+}
+
+void dispatchBakeJob(D3dObjs& d3d, BakeJob& job, ID3D11ShaderResourceView* light_dirs_srv)
+{
+    d3d.context->UpdateSubresource(job.cb, 0, nullptr, &job.cb_data, 0, 0);
+    d3d.context->CSSetConstantBuffers(0, 1, &job.cb);
+
+    auto srvs = std::array{
+        job.colors_srv,
+        job.tr_srv,
+        light_dirs_srv,
+        (d3d.phase_lut_srv != nullptr) ? viewDirLut(d3d, job.cb_data.face, job.cb_data.face_dims, job.cb_data.tile_offset, job.width, job.height) : nullptr,
+        d3d.phase_lut_srv.get(),
+    };
+    d3d.context->CSSetShaderResources(0, srvs.size(), srvs.data());
+
+    auto uavs = std::array{job.sh_coeffs.uav.get()};
+    d3d.context->CSSetUnorderedAccessViews(0, uavs.size(), uavs.data(), nullptr);
+
+    d3d.context->Dispatch((job.width + 7) / 8, (job.height + 7) / 8, job.face_count);
+
+    // clear
+    srvs.fill(nullptr);
+    d3d.context->CSSetShaderResources(0, srvs.size(), srvs.data());
+    uavs.fill(nullptr);
+    d3d.context->CSSetUnorderedAccessViews(0, uavs.size(), uavs.data(), nullptr);
+}
+} // namespace
+
+void dispatchBake(D3dObjs& d3d, bool batched, std::span<BakeJob> jobs)
+{
+    if (batched) {
+        d3d.context->CSSetShader(d3d.bake_batched_cs.get(), nullptr, 0);
+        for (auto& job : jobs) {
+            job.batched_inputs = initBatchedInputs(d3d.device.get(), job.colors);
+
+            job.cb_data.light_count = static_cast<uint32_t>(job.colors.size());
+            job.cb_data.light_dir   = job.colors.back().light_direction; // for validation
+            dispatchBakeJob(d3d, job, job.batched_inputs.light_dirs_srv.get());
+        }
+        return;
+    }
+
+    d3d.context->CSSetShader(d3d.bake_cs.get(), nullptr, 0);
+    const auto light_count = std::ranges::max(jobs | std::views::transform([](auto const& job) { return job.colors.size(); }));
+    for (uint32_t i = 0; i < light_count; ++i) {
+        for (auto& job : jobs) {
+            if (i >= job.colors.size())
+                continue;
+
+            const auto weight       = job.cb_data.weight;
+            job.cb_data.light_count = static_cast<uint32_t>(job.colors.size());
+            job.cb_data.light_dir   = job.colors[i].light_direction;
+            job.cb_data.slice       = i;
+            job.cb_data.weight      = weight * static_cast<float>(job.colors[i].count);
+            dispatchBakeJob(d3d, job, nullptr);
+            job.cb_data.weight = weight;
+        }
+    }
+}
+
+void dispatchValidation(D3dObjs& d3d, const BakeJob& job, ID3D11UnorderedAccessView* out_uav, ID3D11UnorderedAccessView* lut_error_uav)
+{
+    d3d.context->CSSetShader(d3d.validation_cs.get(), nullptr, 0);
+    auto uavs = std::array{out_uav, lut_error_uav};
+    d3d.context->CSSetUnorderedAccessViews(0, uavs.size(), uavs.data(), nullptr);
+
+    auto srvs = std::array<ID3D11ShaderResourceView*, 5>{
+        job.sh_coeffs.srv.get(),
+        job.tr_srv,
+        nullptr,
+        (d3d.phase_lut_srv != nullptr) ? viewDirLut(d3d, job.cb_data.face, job.cb_data.face_dims, job.cb_data.tile_offset, job.width, job.height) : nullptr,
+        d3d.phase_lut_srv.get(),
+    };
+    d3d.context->CSSetShaderResources(0, srvs.size(), srvs.data());
+
+    // still holds the last light of the job
+    d3d.context->CSSetConstantBuffers(0, 1, &job.cb);
+    d3d.context->Dispatch((job.width + 7) / 8, (job.height + 7) / 8, 1);
+
+    // clear
+    uavs.fill(nullptr);
+    d3d.context->CSSetUnorderedAccessViews(0, uavs.size(), uavs.data(), nullptr);
+    srvs.fill(nullptr);
+    d3d.context->CSSetShaderResources(0, srvs.size(), srvs.data());
+}
+
+namespace {
+// structured float4s for the gpu, or a staging copy to read them back
+com_ptr<ID3D11Buffer> createFloat4Buffer(ID3D11Device* device, uint32_t count, bool staging)
+{
+    D3D11_BUFFER_DESC desc = {
+        .ByteWidth           = static_cast<UINT>(sizeof(DirectX::XMFLOAT4) * count),
+        .Usage               = staging ? D3D11_USAGE_STAGING : D3D11_USAGE_DEFAULT,
+        .BindFlags           = staging ? 0U : static_cast<UINT>(D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS),
+        .CPUAccessFlags      = staging ? static_cast<UINT>(D3D11_CPU_ACCESS_READ) : 0U,
+        .MiscFlags           = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED,
+        .StructureByteStride = sizeof(DirectX::XMFLOAT4),
+    };
+    com_ptr<ID3D11Buffer> retval = nullptr;
+    DX::ThrowIfFailed(device->CreateBuffer(&desc, nullptr, retval.put()));
+    return retval;
+}
+
+} // namespace
+
+void dispatchValidationStats(D3dObjs& d3d, BakeJob& job)
+{
+    constexpr uint32_t GROUP_SIZE = 16; // numthreads of Validation.cs.hlsl (ALL)
+
+    const auto light_count = static_cast<uint32_t>(job.colors.size());
+    const auto group_count = ((job.width + GROUP_SIZE - 1) / GROUP_SIZE) * ((job.height + GROUP_SIZE - 1) / GROUP_SIZE);
+
+    if (job.batched_inputs.light_dirs_srv == nullptr)
+        job.batched_inputs = initBatchedInputs(d3d.device.get(), job.colors);
+
+    if (d3d.validation_partials_count < light_count * group_count) {
+        d3d.validation_partials_count = light_count * group_count;
+        d3d.validation_partials       = createFloat4Buffer(d3d.device.get(), d3d.validation_partials_count, false);
+        d3d.validation_partials_srv   = nullptr;
+        d3d.validation_partials_uav   = nullptr;
+        DX::ThrowIfFailed(d3d.device->CreateShaderResourceView(d3d.validation_partials.get(), nullptr, d3d.validation_partials_srv.put()));
+        DX::ThrowIfFailed(d3d.device->CreateUnorderedAccessView(d3d.validation_partials.get(), nullptr, d3d.validation_partials_uav.put()));
+    }
+
+    if (d3d.validation_stats_count < light_count) {
+        d3d.validation_stats_count = light_count;
+        d3d.validation_stats       = createFloat4Buffer(d3d.device.get(), light_count, false);
+        d3d.validation_stats_uav   = nullptr;
+        DX::ThrowIfFailed(d3d.device->CreateUnorderedAccessView(d3d.validation_stats.get(), nullptr, d3d.validation_stats_uav.put()));
+        d3d.validation_staging.clear(); // too small now, pending ones are dropped as they come back
+    }
+
+    d3d.context->CSSetConstantBuffers(0, 1, &job.cb);
+
+    // Per group partials
+    {
+        d3d.context->CSSetShader(d3d.validation_all_cs.get(), nullptr, 0);
+        auto* uav = d3d.validation_partials_uav.get();
+        d3d.context->CSSetUnorderedAccessViews(0, 1, &uav, nullptr);
+
+        auto srvs = std::array<ID3D11ShaderResourceView*, 6>{
+            job.sh_coeffs.srv.get(),
+            job.tr_srv,
+            job.batched_inputs.light_dirs_srv.get(),
+            nullptr,
+            nullptr,
+            job.colors_srv,
+        };
+        d3d.context->CSSetShaderResources(0, srvs.size(), srvs.data());
+        d3d.context->Dispatch((job.width + GROUP_SIZE - 1) / GROUP_SIZE, (job.height + GROUP_SIZE - 1) / GROUP_SIZE, 1);
+
+        // clear
+        srvs.fill(nullptr);
+        d3d.context->CSSetShaderResources(0, srvs.size(), srvs.data());
+    }
+
+    // Per light
+    {
+        d3d.context->CSSetShader(d3d.validation_reduce_cs.get(), nullptr, 0);
+        auto* srv = d3d.validation_partials_srv.get();
+        auto* uav = d3d.validation_stats_uav.get();
+        d3d.context->CSSetUnorderedAccessViews(0, 1, &uav, nullptr);
+        d3d.context->CSSetShaderResources(0, 1, &srv);
+        d3d.context->Dispatch(light_count, 1, 1);
+
+        // clear
+        srv = nullptr;
+        uav = nullptr;
+        d3d.context->CSSetShaderResources(0, 1, &srv);
+        d3d.context->CSSetUnorderedAccessViews(0, 1, &uav, nullptr);
+    }
+
+    com_ptr<ID3D11Buffer> staging = nullptr;
+    if (d3d.validation_staging.empty()) {
+        staging = createFloat4Buffer(d3d.device.get(), d3d.validation_stats_count, true);
+    } else {
+        staging = std::move(d3d.validation_staging.back());
+        d3d.validation_staging.pop_back();
+    }
+    auto& pending = d3d.pending_validations.emplace_back(PendingValidation{
+        .key     = job.key,
+        .colors  = job.colors,
+        .texels  = uint64_t{job.width} * job.height,
+        .staging = std::move(staging),
+    });
+    d3d.context->CopyResource(pending.staging.get(), d3d.validation_stats.get());
+}
+
+namespace {
+// hands a resolved staging buffer back to dispatchValidationStats(), unless the stats have outgrown it
+void releaseValidationStaging(D3dObjs& d3d, com_ptr<ID3D11Buffer>&& staging)
+{
+    D3D11_BUFFER_DESC desc;
+    staging->GetDesc(&desc);
+    if (desc.ByteWidth == sizeof(DirectX::XMFLOAT4) * d3d.validation_stats_count)
+        d3d.validation_staging.push_back(std::move(staging));
+    staging = nullptr;
+}
+
+// one line per set, each light at debug level
+void logValidationStats(std::string_view label, const std::string& key, std::span<const InputTexture> colors, std::span<const ValidationStats> stats, uint64_t texels)
+{
+    double sum_sq_error = 0;
+    double sum_sq_input = 0;
+    float  max_error    = 0;
+    size_t worst        = 0;
+    for (size_t i = 0; i < stats.size(); ++i) {
+        const auto& dir  = colors[i].light_direction;
+        const auto  rmse = std::sqrt(stats[i].sum_sq_error / static_cast<double>(texels));
+        spdlog::debug("\t{}{} light ({:.2f}, {:.2f}, {:.2f}): rmse {:.4g}, max error {:.4g}", label, key, dir.x, dir.y, dir.z, rmse, stats[i].max_error);
+
+        sum_sq_error += stats[i].sum_sq_error;
+        sum_sq_input += stats[i].sum_sq_input;
+        max_error = std::max(max_error, stats[i].max_error);
+        if (stats[i].sum_sq_error > stats[worst].sum_sq_error)
+            worst = i;
+    }
+
+    const auto& worst_dir = colors[worst].light_direction;
+    spdlog::info("\t{}Validated \"{}\", {} lights: rmse {:.4g} ({:.2f}% of the input), max error {:.4g}, worst light ({:.2f}, {:.2f}, {:.2f}) rmse {:.4g}",
+                 label, key, stats.size(), std::sqrt(sum_sq_error / static_cast<double>(texels * stats.size())),
+                 (sum_sq_input > 0) ? 100.0 * std::sqrt(sum_sq_error / sum_sq_input) : 0.0, max_error,
+                 worst_dir.x, worst_dir.y, worst_dir.z, std::sqrt(stats[worst].sum_sq_error / static_cast<double>(texels)));
+}
+
+// maps the stats of earlier dispatchValidationStats() calls, waits for the gpu if they are not done yet
+void resolveValidations(D3dObjs& d3d)
+{
+    for (auto& pending : d3d.pending_validations) {
+        D3D11_MAPPED_SUBRESOURCE mapped;
+        if (FAILED(d3d.context->Map(pending.staging.get(), 0, D3D11_MAP_READ, 0, &mapped))) {
+            spdlog::warn("\t{}Failed to read back the validation of \"{}\"", d3d.label, pending.key);
+            continue;
+        }
+        std::vector<ValidationStats> stats(pending.colors.size());
+        std::memcpy(stats.data(), mapped.pData, sizeof(ValidationStats) * stats.size());
+        d3d.context->Unmap(pending.staging.get(), 0);
+        releaseValidationStaging(d3d, std::move(pending.staging));
+
+        logValidationStats(d3d.label, pending.key, pending.colors, stats, pending.texels);
+    }
+    d3d.pending_validations.clear();
+}
+} // namespace
+
+void dispatchBC6H(D3dObjs& d3d, ID3D11ShaderResourceView* sh_srv, ID3D11UnorderedAccessView* blocks_uav, uint32_t width, uint32_t height, uint32_t sh_slices)
+{
+    d3d.context->CSSetShaderResources(0, 1, &sh_srv);
+    d3d.context->CSSetUnorderedAccessViews(0, 1, &blocks_uav, nullptr);
+
+    d3d.context->CSSetShader(d3d.bc6h_cs.get(), nullptr, 0);
+    d3d.context->Dispatch(((width + 3) / 4 + 7) / 8, ((height + 3) / 4 + 7) / 8, sh_slices);
+
+    // clear
+    ID3D11ShaderResourceView*  null_srv = nullptr;
+    ID3D11UnorderedAccessView* null_uav = nullptr;
+    d3d.context->CSSetShaderResources(0, 1, &null_srv);
+    d3d.context->CSSetUnorderedAccessViews(0, 1, &null_uav, nullptr);
+}
+
+HRESULT readbackTex(D3dObjs& d3d, ID3D11Texture2D* tex, DirectX::ScratchImage& image)
+{
+    D3D11_TEXTURE2D_DESC desc;
+    tex->GetDesc(&desc);
+
+    auto staging = acquireStagingTex(d3d.device.get(), d3d.readback_pools.staging, desc);
+    d3d.context->CopyResource(staging.get(), tex);
+    HRESULT hr = mapStaging(d3d.context.get(), staging.get(), 0, d3d.readback_pools.images, desc.Format, desc.Width, desc.Height, image);
+    d3d.readback_pools.staging.release({.tex = std::move(staging)});
+    return hr;
+}
+
+namespace {
+
+// bakes a face tile by tile, streaming input regions from disk and output blocks back to it, see --tile-size
+// the next tile is read while one bakes, read backs, compression & writes run on the set's own save pipeline
+HRESULT bakeTiled(D3dObjs& d3d, const Arguments& args, Profiler& profiler, const std::string& key, const InputTexSet& tex_set)
+{
+    const auto width  = tex_set.tr.width;
+    const auto height = tex_set.tr.height;
+
+    TiledDDSWriter writer;
+    const auto     sh_slices = shSlices(args.sh_order);
+    HRESULT        hr        = writer.open(args.out_dir / std::format("{}_sh.dds", key), width, height, sh_slices);
+    if (FAILED(hr)) {
+        writer.discard();
+        return hr;
+    }
+
+    // its own, so finish() waits for this set's tiles alone, joined before writer is closed
+    SavePipeline save_pipeline(d3d.device.get(), d3d.context.get(), profiler, args.staging_count, args.writer_threads, args.max_pending_writes, nullptr, &d3d.readback_pools);
+    const auto   fail = [&](HRESULT error) {
+        save_pipeline.finish();
+        writer.discard();
+        return error;
+    };
+
+    BakeJob job{
+        .key = key,
+        .cb_data{
+            .weight    = unitWeight(tex_set.colors),
+            .face      = tex_set.face,
+            .face_dims = {width, height},
+        },
+        .colors = tex_set.colors,
+        .cb     = d3d.common_buffer.get(),
+    };
+
+    // opened once, every tile reads its region of them
+    SetRegionReaders readers;
+    hr = openSetRegions(key, tex_set, args.io_threads, profiler, readers);
+    if (FAILED(hr))
+        return fail(hr);
+
+    struct Tile {
+        uint32_t x      = 0;
+        uint32_t y      = 0;
+        uint32_t width  = 0;
+        uint32_t height = 0;
+    };
+    std::vector<Tile> tiles;
+    for (uint32_t y = 0; y < height; y += args.tile_size)
+        for (uint32_t x = 0; x < width; x += args.tile_size)
+            tiles.push_back({.x = x, .y = y, .width = std::min(args.tile_size, width - x), .height = std::min(args.tile_size, height - y)});
+
+    const auto read_tile = [&](const Tile& tile) {
+        return std::async(std::launch::async, [&, tile]() { return readTileImages(key, readers, tile.x, tile.y, tile.width, tile.height, args.io_threads, profiler); });
+    };
+
+    auto next_images = read_tile(tiles.front());
+    for (size_t i = 0; i < tiles.size(); ++i) {
+        const auto& tile = tiles[i];
+
+        // Stream in, the next tile gets read while this one bakes
+        com_ptr<ID3D11ShaderResourceView> tr_srv;
+        com_ptr<ID3D11Texture2D>          colors_tex;
+        com_ptr<ID3D11ShaderResourceView> colors_srv;
+        {
+            const auto images = next_images.get();
+            if (i + 1 < tiles.size())
+                next_images = read_tile(tiles[i + 1]);
+            if (FAILED(images.hr))
+                return fail(images.hr);
+
+            ScopedTimer timer(profiler, key, Stage::kUpload);
+            hr = DirectX::CreateShaderResourceView(d3d.device.get(), images.tr.GetImages(), images.tr.GetImageCount(), images.tr.GetMetadata(), tr_srv.put());
+            if (SUCCEEDED(hr))
+                hr = initColorArray(d3d.device.get(), images.colors, colors_tex, colors_srv);
+            if (FAILED(hr))
+                return fail(hr);
+        }
+
+        // Bake
+        d3d.gpu_timer.beginFrame();
+        job.sh_coeffs   = acquireTex<true>(d3d, tile.width, tile.height, args.sh_format, sh_slices);
+        float values[4] = {0, 0, 0, 0};
+        d3d.context->ClearUnorderedAccessViewFloat(job.sh_coeffs.uav.get(), values);
+
+        job.cb_data.tile_offset = {tile.x, tile.y};
+        job.colors_srv          = colors_srv.get();
+        job.tr_srv              = tr_srv.get();
+        job.width               = tile.width;
+        job.height              = tile.height;
+        d3d.gpu_timer.begin();
+        dispatchBake(d3d, args.batched, {&job, 1});
+        d3d.gpu_timer.end(Stage::kBake, {{key, 1.0}});
+
+        // Stream out, the pooled textures are only reused once the gpu is done with the copies
+        if (args.gpu_compressor) {
+            auto block_tex = acquireBC6HBlockTex(d3d, tile.width, tile.height, sh_slices);
+            d3d.gpu_timer.begin();
+            dispatchBC6H(d3d, job.sh_coeffs.srv.get(), block_tex.uav.get(), tile.width, tile.height, sh_slices);
+            d3d.gpu_timer.end(Stage::kBC6H, {{key, 1.0}});
+            d3d.gpu_timer.endFrame();
+            save_pipeline.enqueueTile(block_tex.tex.get(), key, &writer, tile.x, tile.y, SaveFormat::kBlocksBC6H, tile.width, tile.height);
+            d3d.tex_pool.release(std::move(block_tex));
+        } else {
+            d3d.gpu_timer.endFrame();
+            save_pipeline.enqueueTile(job.sh_coeffs.tex.get(), key, &writer, tile.x, tile.y, SaveFormat::kCompressCpu);
+        }
+        d3d.gpu_timer.collect(profiler, false);
+        d3d.tex_pool.release(std::move(job.sh_coeffs));
+    }
+
+    hr = save_pipeline.finish();
+    d3d.gpu_timer.collect(profiler, true);
+    if (FAILED(hr))
+        return fail(hr);
+
+    hr = writer.close();
+    if (FAILED(hr)) {
+        spdlog::error("\tFailed to write {}_sh.dds", key);
+        writer.discard();
+    }
+    return hr;
+}
+
+// hardware adapters in dxgi order, so the first one is the default adapter
+std::vector<com_ptr<IDXGIAdapter1>> enumerateAdapters()
+{
+    std::vector<com_ptr<IDXGIAdapter1>> retval;
+
+    com_ptr<IDXGIFactory1> factory = nullptr;
+    if (FAILED(CreateDXGIFactory1(IID_PPV_ARGS(factory.put())))) {
+        spdlog::error("Failed to create IDXGIFactory1");
+        return retval;
+    }
+
+    com_ptr<IDXGIAdapter1> adapter = nullptr;
+    for (UINT i = 0; factory->EnumAdapters1(i, adapter.put()) != DXGI_ERROR_NOT_FOUND; ++i) {
+        DXGI_ADAPTER_DESC1 desc;
+        if (SUCCEEDED(adapter->GetDesc1(&desc)) && (desc.Flags & DXGI_ADAPTER_FLAG_SOFTWARE) == 0)
+            retval.push_back(adapter);
+        adapter = nullptr;
+    }
+    return retval;
+}
+} // namespace
+
+HRESULT selectAdapters(const std::string& gpus, std::vector<com_ptr<IDXGIAdapter1>>& selected)
+{
+    auto adapters = enumerateAdapters();
+    if (adapters.empty()) {
+        spdlog::error("No hardware adapter found");
+        return E_FAIL;
+    }
+
+    selected.clear();
+    if (gpus == "all") {
+        selected = std::move(adapters);
+    } else {
+        for (const auto token : std::views::split(std::string_view{gpus}, ',')) {
+            const std::string_view index_str(token.begin(), token.end());
+            size_t                 index      = 0;
+            const auto [ptr, ec]              = std::from_chars(index_str.data(), index_str.data() + index_str.size(), index);
+            if (ec != std::errc{} || ptr != index_str.data() + index_str.size() || index >= adapters.size()) {
+                spdlog::error("Invalid gpu \"{}\", there are {} adapters", index_str, adapters.size());
+                return E_INVALIDARG;
+            }
+            if (std::ranges::find(selected, adapters[index]) == selected.end())
+                selected.push_back(adapters[index]);
+        }
+    }
+
+    for (size_t i = 0; i < selected.size(); ++i) {
+        DXGI_ADAPTER_DESC1 desc;
+        if (SUCCEEDED(selected[i]->GetDesc1(&desc)))
+            spdlog::info("gpu {}: {} ({} MiB)", i, winrt::to_string(desc.Description), desc.DedicatedVideoMemory >> 20);
+    }
+    return S_OK;
+}
+
+HRESULT initDevice(D3dObjs& d3d, IDXGIAdapter* adapter)
+{
+    ID3D11Device*        base_device      = nullptr;
+    ID3D11DeviceContext* base_device_ctxt = nullptr;
+    D3D_FEATURE_LEVEL    feat_lvls[]      = {D3D_FEATURE_LEVEL_11_0};
+    UINT                 creation_flags   = D3D11_CREATE_DEVICE_BGRA_SUPPORT;
+
+    HRESULT hr = D3D11CreateDevice(adapter, (adapter != nullptr) ? D3D_DRIVER_TYPE_UNKNOWN : D3D_DRIVER_TYPE_HARDWARE,
+                                   nullptr, creation_flags,
+                                   feat_lvls, ARRAYSIZE(feat_lvls),
+                                   D3D11_SDK_VERSION, &base_device,
+                                   nullptr, &base_device_ctxt);
+    if (FAILED(hr)) {
+        spdlog::error("Failed to create ID3D11Device");
+        return hr;
+    }
+
+    // Get 1.1 interface of D3D11 Device and Context
+    hr = base_device->QueryInterface(IID_PPV_ARGS(&d3d.device));
+    if (FAILED(hr)) {
+        spdlog::error("Failed to create ID3D11Device1");
+        return hr;
+    }
+    base_device->Release();
+
+    hr = base_device_ctxt->QueryInterface(IID_PPV_ARGS(&d3d.context));
+    if (FAILED(hr)) {
+        spdlog::error("Failed to create ID3D11DeviceContext1");
+        return hr;
+    }
+    base_device_ctxt->Release();
+
+    return S_OK;
+}
+
+namespace {
+// macros of a Bake.cs.hlsl variant, with L1 for --sh-order 1, null terminated
+std::vector<D3D_SHADER_MACRO> bakeDefines(const Arguments& args, std::initializer_list<D3D_SHADER_MACRO> macros = {})
+{
+    std::vector<D3D_SHADER_MACRO> retval(macros);
+    if (args.sh_order == 1)
+        retval.push_back({"L1", "1"});
+    retval.push_back({nullptr, nullptr});
+    return retval;
+}
+} // namespace
+
+HRESULT initShaders(D3dObjs& d3d, const Arguments& args)
+{
+    {
+        auto hr = initConstantBuffer(d3d.device.get(), d3d.common_buffer);
+        if (FAILED(hr)) {
+            spdlog::warn("Failed to create constant buffer");
+            return hr;
+        }
+    }
+
+    // --phase-lut swaps in the LUT variants, --sh-order 1 the L1 ones of the bake
+    const D3D_SHADER_MACRO lut_defines[] = {{"LUT", "1"}, {nullptr, nullptr}};
+    const bool             l1            = args.sh_order == 1;
+
+    {
+        auto bytecode = l1 ? std::span<const BYTE>(g_Bake_L1) : std::span<const BYTE>(g_Bake);
+        if (args.phase_lut)
+            bytecode = l1 ? std::span<const BYTE>(g_Bake_LUT_L1) : std::span<const BYTE>(g_Bake_LUT);
+
+        const auto defines = args.phase_lut ? bakeDefines(args, {{"LUT", "1"}}) : bakeDefines(args);
+        auto*      base_cs = loadShader(d3d.device.get(), args.shader_dir, "Bake.cs.hlsl", bytecode, d3d.shader_hash, defines.data());
+        if (base_cs == nullptr)
+            return E_FAIL;
+        d3d.bake_cs.attach(base_cs);
+    }
+
+    {
+        auto* base_cs = loadShader(d3d.device.get(), args.shader_dir, "Validation.cs.hlsl", args.phase_lut ? std::span<const BYTE>(g_Validation_LUT) : std::span<const BYTE>(g_Validation),
+                                   d3d.shader_hash, args.phase_lut ? lut_defines : nullptr);
+        if (base_cs == nullptr)
+            return E_FAIL;
+        d3d.validation_cs.attach(base_cs);
+    }
+
+    // --tolerance checks the held out lights with the same kernels
+    if (args.validate || args.tolerance > 0) {
+        const D3D_SHADER_MACRO defines[] = {{"ALL", "1"}, {nullptr, nullptr}};
+
+        auto* all_cs = loadShader(d3d.device.get(), args.shader_dir, "Validation.cs.hlsl", g_Validation_ALL, d3d.shader_hash, defines);
+        if (all_cs == nullptr)
+            return E_FAIL;
+        d3d.validation_all_cs.attach(all_cs);
+
+        auto* reduce_cs = loadShader(d3d.device.get(), args.shader_dir, "ValidationReduce.cs.hlsl", g_ValidationReduce, d3d.shader_hash);
+        if (reduce_cs == nullptr)
+            return E_FAIL;
+        d3d.validation_reduce_cs.attach(reduce_cs);
+    }
+
+    if (args.batched) {
+        // --phase-lut & --group-faces are never combined
+        auto bytecode = l1 ? std::span<const BYTE>(g_Bake_BATCHED_L1) : std::span<const BYTE>(g_Bake_BATCHED);
+        auto variant  = bakeDefines(args, {{"BATCHED", "1"}});
+        if (args.phase_lut) {
+            bytecode = l1 ? std::span<const BYTE>(g_Bake_BATCHED_LUT_L1) : std::span<const BYTE>(g_Bake_BATCHED_LUT);
+            variant  = bakeDefines(args, {{"BATCHED", "1"}, {"LUT", "1"}});
+        } else if (args.group_faces) {
+            bytecode = l1 ? std::span<const BYTE>(g_Bake_BATCHED_FACES_L1) : std::span<const BYTE>(g_Bake_BATCHED_FACES);
+            variant  = bakeDefines(args, {{"BATCHED", "1"}, {"FACES", "1"}});
+        }
+
+        auto* base_cs = loadShader(d3d.device.get(), args.shader_dir, "Bake.cs.hlsl", bytecode, d3d.shader_hash, variant.data());
+        if (base_cs == nullptr)
+            return E_FAIL;
+        d3d.bake_batched_cs.attach(base_cs);
+    }
+
+    if (args.phase_lut) {
+        auto hr = initPhaseLut(d3d);
+        if (FAILED(hr)) {
+            spdlog::error("Failed to create the phase LUT");
+            return hr;
+        }
+    }
+
+    if (args.gpu_compressor) {
+        auto* base_cs = loadShader(d3d.device.get(), args.shader_dir, "BC6H.cs.hlsl", g_BC6H, d3d.shader_hash);
+        if (base_cs == nullptr)
+            return E_FAIL;
+        d3d.bc6h_cs.attach(base_cs);
+    }
+
+    // Common setup
+    {
+        auto* cb = d3d.common_buffer.get();
+        d3d.context->CSSetConstantBuffers(0, 1, &cb);
+        d3d.context->CSSetShader(d3d.bake_cs.get(), nullptr, 0);
+    }
+
+    return S_OK;
+}
+
+namespace {
+// bytes of the per set textures, inputs & outputs, used to size --concurrent-sets 0
+uint64_t bakeJobBytes(const Arguments& args, const InputTexSet& tex_set)
+{
+    const auto     width       = tex_set.tr.width;
+    const auto     height      = tex_set.tr.height;
+    const auto     face_count  = static_cast<uint32_t>(std::max<size_t>(1, tex_set.faces.size()));
+    const uint64_t face_texels = uint64_t{width} * height;
+    const uint64_t texels      = face_texels * face_count;
+
+    // the colors of every face & a tr each, uploaded per set
+    uint64_t bytes = face_texels * tex_set.colors.size() * DirectX::BitsPerPixel(tex_set.colors.front().format) / 8;
+    bytes += texels * DirectX::BitsPerPixel(tex_set.tr.format) / 8;
+
+    bytes += texels * shSlices(args.sh_order) * DirectX::BitsPerPixel(args.sh_format) / 8;
+    if (args.gpu_compressor)
+        bytes += uint64_t{(width + 3) / 4} * ((height + 3) / 4) * 16 * shSlices(args.sh_order) * face_count;
+    if (!args.validation_dir.empty())
+        bytes += texels * 4 * (args.phase_lut ? 2 : 1);
+    if (args.phase_lut)
+        bytes += texels * sizeof(DirectX::XMFLOAT4); // view directions, see viewDirLut
+    return bytes;
+}
+
+// local video memory this process may still use, 0 if unknown
+uint64_t freeVideoMemory(const com_ptr<ID3D11Device1>& device)
+{
+    auto dxgi_device = device.try_as<IDXGIDevice>();
+    if (!dxgi_device)
+        return 0;
+    com_ptr<IDXGIAdapter> adapter = nullptr;
+    if (FAILED(dxgi_device->GetAdapter(adapter.put())))
+        return 0;
+    auto adapter3 = adapter.try_as<IDXGIAdapter3>();
+    if (!adapter3)
+        return 0;
+
+    DXGI_QUERY_VIDEO_MEMORY_INFO info = {};
+    if (FAILED(adapter3->QueryVideoMemoryInfo(0, DXGI_MEMORY_SEGMENT_GROUP_LOCAL, &info)) || info.CurrentUsage >= info.Budget)
+        return 0;
+    return info.Budget - info.CurrentUsage;
+}
+
+// compresses, validates & saves the baked jobs, ends the gpu frame bakeSets or bakeProgressive began
+void finishSets(D3dObjs& d3d, const Arguments& args, SavePipeline& save_pipeline, std::span<BakeJob> jobs, const GpuTimer::Shares& shares)
+{
+    if (args.gpu_compressor) {
+        d3d.gpu_timer.begin();
+        for (auto& job : jobs) {
+            job.bc6h = acquireBC6HBlockTex(d3d, job.width, job.height, shSlices(args.sh_order) * job.face_count);
+            dispatchBC6H(d3d, job.sh_coeffs.srv.get(), job.bc6h.uav.get(), job.width, job.height, shSlices(args.sh_order) * job.face_count);
+        }
+        d3d.gpu_timer.end(Stage::kBC6H, shares);
+    }
+
+    // Validation
+    std::vector<ShTexture> valid_texs;
+    std::vector<ShTexture> lut_error_texs; // --phase-lut only
+    if (args.validate) {
+        d3d.gpu_timer.begin();
+        for (auto& job : jobs)
+            dispatchValidationStats(d3d, job);
+        d3d.gpu_timer.end(Stage::kValidation, shares);
+    }
+    if (!args.validation_dir.empty()) {
+        d3d.gpu_timer.begin();
+        for (auto& job : jobs) {
+            auto& valid_tex = valid_texs.emplace_back(acquireTex<false>(d3d, job.width, job.height));
+            if (args.phase_lut) {
+                auto& lut_error_tex = lut_error_texs.emplace_back(acquireTex<false>(d3d, job.width, job.height));
+                dispatchValidation(d3d, job, valid_tex.uav.get(), lut_error_tex.uav.get());
+            } else {
+                dispatchValidation(d3d, job, valid_tex.uav.get());
+            }
+        }
+        d3d.gpu_timer.end(Stage::kValidation, shares);
+    }
+    d3d.gpu_timer.endFrame();
+
+    // Save textures
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        auto& job = jobs[i];
+        if (args.gpu_compressor)
+            save_pipeline.enqueue(job.bc6h.tex.get(), job.key, args.out_dir / std::format("{}_sh.dds", job.key), SaveFormat::kBlocksBC6H, job.width, job.height, job.pack_info);
+        else
+            save_pipeline.enqueue(job.sh_coeffs.tex.get(), job.key, args.out_dir / std::format("{}_sh.dds", job.key), SaveFormat::kCompressCpu, 0, 0, job.pack_info);
+
+        if (!valid_texs.empty()) {
+            const auto& light_dir = job.cb_data.light_dir;
+            save_pipeline.enqueue(valid_texs[i].tex.get(), job.key,
+                                  args.validation_dir / std::format("{}_{:.2f}_{:.2f}_{:.2f}_re.dds", job.key, light_dir.x, light_dir.y, light_dir.z), SaveFormat::kRaw);
+        }
+        if (!lut_error_texs.empty()) {
+            const auto& light_dir = job.cb_data.light_dir;
+            save_pipeline.enqueue(lut_error_texs[i].tex.get(), job.key,
+                                  args.validation_dir / std::format("{}_{:.2f}_{:.2f}_{:.2f}_lut_err.dds", job.key, light_dir.x, light_dir.y, light_dir.z), SaveFormat::kRaw);
+        }
+    }
+
+    // gpu keeps them alive until the pending copies are done
+    for (auto& job : jobs) {
+        d3d.tex_pool.release(std::move(job.sh_coeffs));
+        d3d.tex_pool.release(std::move(job.bc6h));
+    }
+    for (auto& valid_tex : valid_texs)
+        d3d.tex_pool.release(std::move(valid_tex));
+    for (auto& lut_error_tex : lut_error_texs)
+        d3d.tex_pool.release(std::move(lut_error_tex));
+}
+
+// bakes, compresses & validates all jobs before the first of them is read back
+void bakeSets(D3dObjs& d3d, const Arguments& args, SavePipeline& save_pipeline, Profiler& profiler, std::span<BakeJob> jobs)
+{
+    // interleaved, so gpu time is split by the work each set adds
+    GpuTimer::Shares shares;
+    for (auto const& job : jobs)
+        shares.emplace_back(job.key, static_cast<double>(job.width) * job.height * job.face_count * job.colors.size());
+
+    // the previous batch is done by now, or close to
+    resolveValidations(d3d);
+
+    d3d.gpu_timer.beginFrame();
+    for (auto& job : jobs) {
+        job.sh_coeffs   = acquireTex<true>(d3d, job.width, job.height, args.sh_format, shSlices(args.sh_order) * job.face_count);
+        float values[4] = {0, 0, 0, 0};
+        d3d.context->ClearUnorderedAccessViewFloat(job.sh_coeffs.uav.get(), values);
+    }
+
+    // Dispatch
+    d3d.gpu_timer.begin();
+    dispatchBake(d3d, args.batched, jobs);
+    d3d.gpu_timer.end(Stage::kBake, shares);
+
+    finishSets(d3d, args, save_pipeline, jobs, shares);
+    d3d.gpu_timer.collect(profiler, false);
+}
+
+// lights reordered so every prefix covers the sphere evenly, each next light is the farthest from those before it, see --tolerance
+// the directions are normalized by loadInputFile
+std::vector<uint32_t> progressiveOrder(std::span<const InputTexture> colors)
+{
+    const auto            count = static_cast<uint32_t>(colors.size());
+    std::vector<uint32_t> order = {0};
+    std::vector<float>    closest(count, -2.F); // cos to the closest ordered light, lower is farther
+    std::vector<bool>     ordered(count, false);
+    ordered[0] = true;
+
+    for (uint32_t last = 0; order.size() < count;) {
+        const auto& last_dir = colors[last].light_direction;
+        uint32_t    next     = 0;
+        float       next_cos = 2.F;
+        for (uint32_t i = 0; i < count; ++i) {
+            if (ordered[i])
+                continue;
+            const auto& dir = colors[i].light_direction;
+            closest[i]      = std::max(closest[i], (last_dir.x * dir.x) + (last_dir.y * dir.y) + (last_dir.z * dir.z));
+            if (closest[i] < next_cos) {
+                next     = i;
+                next_cos = closest[i];
+            }
+        }
+        ordered[next] = true;
+        order.push_back(next);
+        last = next;
+    }
+    return order;
+}
+
+// --tolerance, bakes a growing prefix of the lights in progressiveOrder until the held out ones reconstruct within tolerance
+// lights are read & uploaded a stage at a time, stages double the lights & bake only those they add into one texture,
+// which is compressed & saved once the last stage is validated
+HRESULT bakeProgressive(D3dObjs& d3d, const Arguments& args, Profiler& profiler, SavePipeline& save_pipeline, const std::string& key, InputTexSet& tex_set)
+{
+    constexpr uint32_t HELD_OUT_STRIDE = 8; // one in 8 lights of the order is held out
+    constexpr uint32_t FIRST_STAGE     = 8;
+
+    const auto light_count = static_cast<uint32_t>(tex_set.colors.size());
+    const auto width       = tex_set.tr.width;
+    const auto height      = tex_set.tr.height;
+    if (light_count > D3D11_REQ_TEXTURE2D_ARRAY_AXIS_DIMENSION) {
+        spdlog::error("\t{}Too many color textures ({} > {})", d3d.label, light_count, D3D11_REQ_TEXTURE2D_ARRAY_AXIS_DIMENSION);
+        return E_INVALIDARG;
+    }
+
+    // baked in order, the held out ones last, so slices [0, n) of the array always hold the first n lights
+    // sets of fewer than two strides have too few lights to hold any out, they bake all of them
+    const auto held_out_count = (light_count >= 2 * HELD_OUT_STRIDE) ? light_count / HELD_OUT_STRIDE : 0;
+    const auto candidates     = light_count - held_out_count;
+    {
+        std::vector<InputTexture> kept;
+        std::vector<InputTexture> held_out;
+        const auto                order = progressiveOrder(tex_set.colors);
+        for (size_t i = 0; i < order.size(); ++i) {
+            auto& color = tex_set.colors[order[i]];
+            if (held_out_count > 0 && i % HELD_OUT_STRIDE == HELD_OUT_STRIDE - 1)
+                held_out.push_back(std::move(color));
+            else
+                kept.push_back(std::move(color));
+        }
+        std::ranges::move(held_out, std::back_inserter(kept));
+        tex_set.colors = std::move(kept);
+    }
+
+    // Inputs, the tr at once, the colors into an array filled as the stages need them
+    const auto upload_colors = [&](uint32_t first, uint32_t count) {
+        ScopedTimer             timer(profiler, key, Stage::kUpload);
+        std::vector<InputImage> images(count);
+        std::vector<HRESULT>    results(count, S_OK);
+        parallelFor(count, args.io_threads, [&](size_t idx) { results[idx] = loadInputImage(tex_set.colors[first + idx].path, args.mmap, images[idx]); });
+        for (uint32_t i = 0; i < count; ++i) {
+            if (FAILED(results[i]))
+                return results[i];
+            const auto& image = images[i].image;
+            d3d.context->UpdateSubresource(tex_set.colors_tex.get(), D3D11CalcSubresource(0, first + i, 1), nullptr, image.pixels,
+                                           static_cast<UINT>(image.rowPitch), static_cast<UINT>(image.slicePitch));
+        }
+        return S_OK;
+    };
+    const auto upload_failed = [&](HRESULT hr) {
+        spdlog::warn("\t{}Failed to upload texture set \"{}\". Skipping the whole set", d3d.label, key);
+        releaseSet(tex_set);
+        return hr;
+    };
+
+    com_ptr<ID3D11ShaderResourceView> held_out_srv = nullptr;
+    {
+        ScopedTimer timer(profiler, key, Stage::kUpload);
+        InputImage  tr;
+        HRESULT     hr = loadInputImage(tex_set.tr.path, args.mmap, tr);
+        if (SUCCEEDED(hr))
+            hr = DirectX::CreateShaderResourceView(d3d.device.get(), &tr.image, 1, tr.metadata, tex_set.tr.srv.put());
+
+        D3D11_TEXTURE2D_DESC tex_desc = {
+            .Width          = width,
+            .Height         = height,
+            .MipLevels      = 1,
+            .ArraySize      = light_count,
+            .Format         = tex_set.colors.front().format,
+            .SampleDesc     = {.Count = 1, .Quality = 0},
+            .Usage          = D3D11_USAGE_DEFAULT,
+            .BindFlags      = D3D11_BIND_SHADER_RESOURCE,
+            .CPUAccessFlags = 0,
+            .MiscFlags      = 0,
+        };
+        if (SUCCEEDED(hr))
+            hr = d3d.device->CreateTexture2D(&tex_desc, nullptr, tex_set.colors_tex.put());
+
+        D3D11_SHADER_RESOURCE_VIEW_DESC srv_desc = {
+            .Format         = tex_desc.Format,
+            .ViewDimension  = D3D11_SRV_DIMENSION_TEXTURE2DARRAY,
+            .Texture2DArray = {.MostDetailedMip = 0, .MipLevels = 1, .FirstArraySlice = 0, .ArraySize = light_count},
+        };
+        if (SUCCEEDED(hr))
+            hr = d3d.device->CreateShaderResourceView(tex_set.colors_tex.get(), &srv_desc, tex_set.colors_srv.put());
+
+        // the held out slices alone, as the validation kernel reads its lights from slice 0
+        srv_desc.Texture2DArray.FirstArraySlice = candidates;
+        srv_desc.Texture2DArray.ArraySize       = held_out_count;
+        if (SUCCEEDED(hr) && held_out_count > 0)
+            hr = d3d.device->CreateShaderResourceView(tex_set.colors_tex.get(), &srv_desc, held_out_srv.put());
+        if (FAILED(hr))
+            return upload_failed(hr);
+    }
+    if (HRESULT hr = upload_colors(candidates, held_out_count); FAILED(hr))
+        return upload_failed(hr);
+
+    BakeJob job{
+        .key = key,
+        .cb_data{
+            .face      = tex_set.face,
+            .face_dims = {width, height},
+        },
+        .colors_srv = tex_set.colors_srv.get(),
+        .tr_srv     = tex_set.tr.srv.get(),
+        .cb         = d3d.common_buffer.get(),
+        .width      = width,
+        .height     = height,
+        .pack_info  = packInfo(tex_set),
+    };
+    BakeJob held_out_job = job;
+    held_out_job.colors     = std::span(tex_set.colors).last(held_out_count);
+    held_out_job.colors_srv = held_out_srv.get();
+
+    // adds lights [baked, last) to the coefficients, rescaling what they hold, so they always hold the mean over [0, last)
+    // the kernel reads its lights from slice 0, so each dispatch gets a view of its slices alone
+    uint32_t   baked       = 0;
+    const auto bake_lights = [&](uint32_t last) {
+        const auto                        lights   = std::span(tex_set.colors).first(last);
+        com_ptr<ID3D11ShaderResourceView> srv      = nullptr;
+        D3D11_SHADER_RESOURCE_VIEW_DESC   srv_desc = {
+            .Format         = lights.front().format,
+            .ViewDimension  = D3D11_SRV_DIMENSION_TEXTURE2DARRAY,
+            .Texture2DArray = {.MostDetailedMip = 0, .MipLevels = 1, .FirstArraySlice = baked, .ArraySize = last - baked},
+        };
+        DX::ThrowIfFailed(d3d.device->CreateShaderResourceView(tex_set.colors_tex.get(), &srv_desc, srv.put()));
+
+        job.colors             = lights.subspan(baked);
+        job.colors_srv         = srv.get();
+        job.cb_data.weight     = unitWeight(lights);
+        job.cb_data.prev_scale = (baked > 0) ? job.cb_data.weight / unitWeight(lights.first(baked)) : 0.F;
+        d3d.gpu_timer.begin();
+        dispatchBake(d3d, true, {&job, 1});
+        d3d.gpu_timer.end(Stage::kBake, {{key, static_cast<double>(width) * height * job.colors.size()}});
+        baked = last;
+    };
+
+    // one texture for every stage, the first one overwrites it
+    d3d.gpu_timer.beginFrame();
+    job.sh_coeffs           = acquireTex<true>(d3d, width, height, args.sh_format, shSlices(args.sh_order));
+    const auto stage_failed = [&](HRESULT hr) {
+        d3d.gpu_timer.endFrame();
+        d3d.tex_pool.release(std::move(job.sh_coeffs));
+        return upload_failed(hr);
+    };
+
+    // Stages, each bakes only the lights it adds
+    uint32_t used     = (held_out_count > 0) ? std::min(FIRST_STAGE, candidates) : light_count;
+    uint32_t uploaded = 0;
+    double   error    = 0;
+    for (bool stop = held_out_count == 0; !stop;) {
+        if (HRESULT hr = upload_colors(uploaded, used - uploaded); FAILED(hr))
+            return stage_failed(hr);
+        uploaded = used;
+        bake_lights(used);
+
+        // the held out lights against the coefficients, the constant buffer still holds the bake's light count
+        held_out_job.sh_coeffs           = job.sh_coeffs;
+        held_out_job.cb_data             = job.cb_data;
+        held_out_job.cb_data.light_count = held_out_count;
+        d3d.context->UpdateSubresource(held_out_job.cb, 0, nullptr, &held_out_job.cb_data, 0, 0);
+        dispatchValidationStats(d3d, held_out_job);
+
+        auto                         pending = std::move(d3d.pending_validations.back());
+        std::vector<ValidationStats> stats(held_out_count);
+        d3d.pending_validations.pop_back();
+        held_out_job.sh_coeffs = {};
+
+        D3D11_MAPPED_SUBRESOURCE mapped;
+        DX::ThrowIfFailed(d3d.context->Map(pending.staging.get(), 0, D3D11_MAP_READ, 0, &mapped));
+        std::memcpy(stats.data(), mapped.pData, sizeof(ValidationStats) * stats.size());
+        d3d.context->Unmap(pending.staging.get(), 0);
+        releaseValidationStaging(d3d, std::move(pending.staging));
+
+        double sum_sq_error = 0;
+        double sum_sq_input = 0;
+        for (auto const& light : stats) {
+            sum_sq_error += light.sum_sq_error;
+            sum_sq_input += light.sum_sq_input;
+        }
+        error = (sum_sq_input > 0) ? std::sqrt(sum_sq_error / sum_sq_input) : 0.0;
+        spdlog::debug("\t{}{} lights: held out rmse {:.2f}% of the input", d3d.label, used, 100.0 * error);
+
+        stop = error <= args.tolerance || used == candidates;
+        if (!stop)
+            used = std::min(used * 2, candidates);
+    }
+
+    // with every candidate in, the held out lights are uploaded already & get baked too
+    if (used == candidates)
+        used = light_count;
+    if (held_out_count > 0)
+        spdlog::info("\t{}Used {} of {} light directions, held out rmse {:.2f}% of the input", d3d.label, used, light_count, 100.0 * error);
+
+    if (HRESULT hr = upload_colors(uploaded, std::min(used, candidates) - uploaded); FAILED(hr))
+        return stage_failed(hr);
+    if (baked < used)
+        bake_lights(used);
+
+    // the last stage's coefficients are the set's, compressed, validated & saved like those of bakeSets
+    job.colors              = std::span(tex_set.colors).first(used);
+    job.colors_srv          = tex_set.colors_srv.get();
+    job.batched_inputs      = {};
+    job.cb_data.light_count = used;
+    job.cb_data.prev_scale  = 0;
+    d3d.context->UpdateSubresource(job.cb, 0, nullptr, &job.cb_data, 0, 0);
+    finishSets(d3d, args, save_pipeline, {&job, 1}, {{key, static_cast<double>(width) * height * used}});
+    d3d.gpu_timer.collect(profiler, false);
+
+    // the gpu keeps the inputs alive until the queued work is done
+    releaseSet(tex_set);
+    return S_OK;
+}
+
+// Cpu backend, a port of Bake.cs.hlsl (BATCHED) & Validation.cs.hlsl for machines without a gpu, see --backend
+// avx2 & scalar paths only use mul/add/div/sqrt, so both give the same bits
+
+struct CpuLight {
+    DirectX::XMFLOAT3     neg_dir; // dot(-view_dir, dir) = dot(view_dir, -dir)
+    std::array<float, 9>  basis;   // ProjectOntoL2(dir, weight * count * 4 * pi)
+    const DirectX::Image* color = nullptr;
+};
+
+// per texel inputs of a row, structure of arrays so 8 texels load at once
+struct CpuRow {
+    std::vector<float> view_x;
+    std::vector<float> view_y;
+    std::vector<float> view_z;
+    std::vector<float> iso_weight;
+
+    void init(uint32_t face, uint32_t y, uint32_t height, std::span<const float> face_pos_x, const float* tr)
+    {
+        const auto width      = face_pos_x.size();
+        const auto face_pos_y = faceTan(y, height);
+        view_x.resize(width);
+        view_y.resize(width);
+        view_z.resize(width);
+        iso_weight.resize(width);
+        for (size_t x = 0; x < width; ++x) {
+            const auto view_dir = viewDirFromFace(face, face_pos_x[x], face_pos_y);
+            view_x[x]           = view_dir.x;
+            view_y[x]           = view_dir.y;
+            view_z[x]           = view_dir.z;
+            iso_weight[x]       = 1.F - std::sqrt(tr[x]);
+        }
+    }
+};
+
+// one row of the bake, out holds the R32G32B32A32_FLOAT slices of the row, coeff_count is 4 for L1 & 9 for L2
+// L1 is the first 4 coefficients of L2, so the lights keep all 9 in their basis
+template <size_t coeff_count>
+void bakeRowCpu(const CpuRow& row, uint32_t y, std::span<const CpuLight> lights, const std::array<float*, 3>& out)
+{
+    const auto width = row.view_x.size();
+
+    const auto store = [&out](size_t x, const float* sh, size_t stride) {
+        for (size_t slice = 0; slice < (coeff_count + 2) / 3; ++slice) {
+            auto* texel = out[slice] + (x * 4);
+            for (size_t i = 0; i < 3; ++i)
+                texel[i] = ((slice * 3) + i < coeff_count) ? sh[((slice * 3) + i) * stride] : 0.F;
+            texel[3] = 0.F;
+        }
+    };
+    const auto color_at = [y](const CpuLight& light, size_t x) { return reinterpret_cast<const float*>(light.color->pixels + (y * light.color->rowPitch)) + x; };
+
+    size_t x = 0;
+#ifdef __AVX2__
+    for (; x + 8 <= width; x += 8) {
+        const __m256 view_x     = _mm256_loadu_ps(row.view_x.data() + x);
+        const __m256 view_y     = _mm256_loadu_ps(row.view_y.data() + x);
+        const __m256 view_z     = _mm256_loadu_ps(row.view_z.data() + x);
+        const __m256 iso_weight = _mm256_loadu_ps(row.iso_weight.data() + x);
+
+        __m256 sh[coeff_count];
+        for (auto& coeff : sh)
+            coeff = _mm256_setzero_ps();
+        for (auto const& light : lights) {
+            const __m256 cos_theta = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(view_x, _mm256_set1_ps(light.neg_dir.x)),
+                                                                 _mm256_mul_ps(view_y, _mm256_set1_ps(light.neg_dir.y))),
+                                                   _mm256_mul_ps(view_z, _mm256_set1_ps(light.neg_dir.z)));
+            const __m256 value     = _mm256_div_ps(_mm256_loadu_ps(color_at(light, x)), msHeuristicPhase(cos_theta, iso_weight));
+            for (size_t i = 0; i < coeff_count; ++i)
+                sh[i] = _mm256_add_ps(sh[i], _mm256_mul_ps(_mm256_set1_ps(light.basis[i]), value));
+        }
+
+        alignas(32) std::array<float, coeff_count * 8> lanes;
+        for (size_t i = 0; i < coeff_count; ++i)
+            _mm256_store_ps(lanes.data() + (i * 8), sh[i]);
+        for (size_t lane = 0; lane < 8; ++lane)
+            store(x + lane, lanes.data() + lane, 8);
+    }
+#endif
+    for (; x < width; ++x) {
+        std::array<float, coeff_count> sh = {};
+        for (auto const& light : lights) {
+            const float cos_theta = (row.view_x[x] * light.neg_dir.x) + (row.view_y[x] * light.neg_dir.y) + (row.view_z[x] * light.neg_dir.z);
+            const float value     = *color_at(light, x) / msHeuristicPhase(cos_theta, row.iso_weight[x]);
+            for (size_t i = 0; i < sh.size(); ++i)
+                sh[i] += light.basis[i] * value;
+        }
+        store(x, sh.data(), 1);
+    }
+}
+
+// colors & tr as sampled by Texture2D<float>, the red channel as float
+HRESULT toFloatImage(InputImage& input)
+{
+    const auto format = input.image.format;
+    if (format == DXGI_FORMAT_R32_FLOAT)
+        return S_OK;
+
+    DirectX::ScratchImage converted;
+    HRESULT               hr = DirectX::IsCompressed(format)
+                                   ? DirectX::Decompress(input.image, DXGI_FORMAT_R32_FLOAT, converted)
+                                   : DirectX::Convert(input.image, DXGI_FORMAT_R32_FLOAT, DirectX::TEX_FILTER_DEFAULT, DirectX::TEX_THRESHOLD_DEFAULT, converted);
+    if (SUCCEEDED(hr)) {
+        input.scratch  = std::move(converted);
+        input.mapping  = {};
+        input.image    = *input.scratch.GetImage(0, 0, 0);
+        input.metadata = input.scratch.GetMetadata();
+    }
+    return hr;
+}
+
+// bakes a whole set with all light directions at once, like the BATCHED kernel, and queues the outputs
+HRESULT bakeSetCpu(const Arguments& args, Profiler& profiler, SavePipeline& save_pipeline, const std::string& key, const InputTexSet& tex_set, SetImages& images)
+{
+    HRESULT hr = toFloatImage(images.tr);
+    for (auto& color : images.colors)
+        if (SUCCEEDED(hr))
+            hr = toFloatImage(color);
+    if (FAILED(hr)) {
+        spdlog::warn("\tFailed to convert texture set \"{}\" to float", key);
+        return hr;
+    }
+
+    const auto width  = tex_set.tr.width;
+    const auto height = tex_set.tr.height;
+    const auto weight = unitWeight(tex_set.colors);
+
+    std::vector<CpuLight> lights;
+    lights.reserve(tex_set.colors.size());
+    for (size_t i = 0; i < tex_set.colors.size(); ++i) {
+        const auto& dir = tex_set.colors[i].light_direction;
+        lights.push_back({
+            .neg_dir = {-dir.x, -dir.y, -dir.z},
+            .basis   = projectOntoL2(dir, weight * static_cast<float>(tex_set.colors[i].count) * 4 * SHADER_PI),
+            .color   = &images.colors[i].image,
+        });
+    }
+
+    std::vector<float> face_pos_x(width);
+    for (uint32_t x = 0; x < width; ++x)
+        face_pos_x[x] = faceTan(x, width);
+
+    const auto* tr_img  = &images.tr.image;
+    const auto  tr_row  = [tr_img](size_t y) { return reinterpret_cast<const float*>(tr_img->pixels + (y * tr_img->rowPitch)); };
+
+    const auto            sh_slices   = shSlices(args.sh_order);
+    const auto            coeff_count = shCoeffs(args.sh_order);
+    DirectX::ScratchImage sh_image;
+    hr = sh_image.Initialize2D(DXGI_FORMAT_R32G32B32A32_FLOAT, width, height, sh_slices, 1);
+    if (FAILED(hr))
+        return hr;
+
+    {
+        ScopedTimer timer(profiler, key, Stage::kBake);
+        parallelFor(height, args.cpu_threads, [&](size_t y) {
+            thread_local CpuRow row;
+            row.init(tex_set.face, static_cast<uint32_t>(y), height, face_pos_x, tr_row(y));
+
+            std::array<float*, 3> out = {};
+            for (size_t slice = 0; slice < sh_slices; ++slice) {
+                const auto* img = sh_image.GetImage(0, slice, 0);
+                out[slice]      = reinterpret_cast<float*>(img->pixels + (y * img->rowPitch));
+            }
+            if (args.sh_order == 1)
+                bakeRowCpu<shCoeffs(1)>(row, static_cast<uint32_t>(y), lights, out);
+            else
+                bakeRowCpu<shCoeffs(2)>(row, static_cast<uint32_t>(y), lights, out);
+        });
+    }
+
+    // Validation of every light, see --validate
+    if (args.validate) {
+        ScopedTimer timer(profiler, key, Stage::kValidation);
+
+        std::vector<std::array<float, 9>> unit_basis;
+        unit_basis.reserve(tex_set.colors.size());
+        for (auto const& color : tex_set.colors)
+            unit_basis.push_back(projectOntoL2(color.light_direction, 1.F));
+
+        // per row & light, summed up after so the result does not depend on the thread count
+        const size_t                       light_count = lights.size();
+        std::vector<std::array<double, 3>> row_stats(size_t{height} * light_count, {0., 0., 0.});
+        parallelFor(height, args.cpu_threads, [&](size_t y) {
+            thread_local CpuRow row;
+            row.init(tex_set.face, static_cast<uint32_t>(y), height, face_pos_x, tr_row(y));
+
+            std::array<const float*, 3> sh_rows = {};
+            for (size_t slice = 0; slice < sh_slices; ++slice) {
+                const auto* img = sh_image.GetImage(0, slice, 0);
+                sh_rows[slice]  = reinterpret_cast<const float*>(img->pixels + (y * img->rowPitch));
+            }
+
+            for (size_t l = 0; l < light_count; ++l) {
+                const auto& light = lights[l];
+                const auto* input = reinterpret_cast<const float*>(light.color->pixels + (y * light.color->rowPitch));
+                auto&       acc   = row_stats[(y * light_count) + l];
+                for (uint32_t x = 0; x < width; ++x) {
+                    float color = 0.F;
+                    for (size_t i = 0; i < coeff_count; ++i)
+                        color += unit_basis[l][i] * sh_rows[i / 3][(x * 4) + (i % 3)];
+
+                    const float cos_theta = (row.view_x[x] * light.neg_dir.x) + (row.view_y[x] * light.neg_dir.y) + (row.view_z[x] * light.neg_dir.z);
+                    const float error     = (color * msHeuristicPhase(cos_theta, row.iso_weight[x])) - input[x];
+                    acc[0] += error * error;
+                    acc[1] = std::max<double>(acc[1], std::abs(error));
+                    acc[2] += input[x] * input[x];
+                }
+            }
+        });
+
+        std::vector<ValidationStats> stats(light_count);
+        for (size_t i = 0; i < row_stats.size(); ++i) {
+            auto& light_stats = stats[i % light_count];
+            light_stats.sum_sq_error += static_cast<float>(row_stats[i][0]);
+            light_stats.max_error = std::max(light_stats.max_error, static_cast<float>(row_stats[i][1]));
+            light_stats.sum_sq_input += static_cast<float>(row_stats[i][2]);
+        }
+        logValidationStats("", key, tex_set.colors, stats, uint64_t{width} * height);
+    }
+
+    // Validation, with the last light like the gpu path
+    DirectX::ScratchImage valid_image;
+    if (!args.validation_dir.empty()) {
+        ScopedTimer timer(profiler, key, Stage::kValidation);
+
+        const auto& light_dir = tex_set.colors.back().light_direction;
+        const auto  basis     = projectOntoL2(light_dir, 1.F);
+
+        hr = valid_image.Initialize2D(DXGI_FORMAT_R32_FLOAT, width, height, 1, 1);
+        if (FAILED(hr))
+            return hr;
+        parallelFor(height, args.cpu_threads, [&](size_t y) {
+            const auto face_pos_y = faceTan(static_cast<uint32_t>(y), height);
+            const auto tr         = tr_row(y);
+            auto*      out        = reinterpret_cast<float*>(valid_image.GetImage(0, 0, 0)->pixels + (y * valid_image.GetImage(0, 0, 0)->rowPitch));
+
+            std::array<const float*, 3> sh_rows = {};
+            for (size_t slice = 0; slice < sh_slices; ++slice) {
+                const auto* img = sh_image.GetImage(0, slice, 0);
+                sh_rows[slice]  = reinterpret_cast<const float*>(img->pixels + (y * img->rowPitch));
+            }
+
+            for (uint32_t x = 0; x < width; ++x) {
+                float color = 0.F;
+                for (size_t i = 0; i < coeff_count; ++i)
+                    color += basis[i] * sh_rows[i / 3][(x * 4) + (i % 3)];
+
+                const auto  view_dir  = viewDirFromFace(tex_set.face, face_pos_x[x], face_pos_y);
+                const float cos_theta = -((view_dir.x * light_dir.x) + (view_dir.y * light_dir.y) + (view_dir.z * light_dir.z));
+                out[x]                = color * msHeuristicPhase(cos_theta, 1.F - std::sqrt(tr[x]));
+            }
+        });
+    }
+
+    if (args.sh_format != DXGI_FORMAT_R32G32B32A32_FLOAT) {
+        DirectX::ScratchImage converted;
+        hr = DirectX::Convert(sh_image.GetImages(), sh_image.GetImageCount(), sh_image.GetMetadata(), args.sh_format, DirectX::TEX_FILTER_DEFAULT, DirectX::TEX_THRESHOLD_DEFAULT, converted);
+        if (FAILED(hr))
+            return hr;
+        sh_image = std::move(converted);
+    }
+
+    // Save textures
+    save_pipeline.enqueueImage(std::move(sh_image), key, args.out_dir / std::format("{}_sh.dds", key), true, packInfo(tex_set));
+    if (!args.validation_dir.empty()) {
+        const auto& light_dir = tex_set.colors.back().light_direction;
+        save_pipeline.enqueueImage(std::move(valid_image), key,
+                                   args.validation_dir / std::format("{}_{:.2f}_{:.2f}_{:.2f}_re.dds", key, light_dir.x, light_dir.y, light_dir.z), false);
+    }
+    return S_OK;
+}
+
+// D3D12 backend, the bake & single light validation kernels on a compute queue, read backs on a copy queue, see --backend d3d12
+// fences order the two queues, so a set bakes while the previous ones are read back, with no hazard tracking by a driver
+// each frame holds one set in flight, there are --staging-count of them
+
+constexpr UINT     SRV_TABLE_SIZE        = 5; // t0-t4 of Bake.cs.hlsl & Validation.cs.hlsl
+constexpr UINT     UAV_TABLE_SIZE        = 2; // u0-u1
+constexpr UINT     DESCRIPTORS_PER_FRAME = 2 * (SRV_TABLE_SIZE + UAV_TABLE_SIZE); // bake, then validation
+constexpr uint64_t CB_STRIDE             = D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT;
+constexpr uint32_t TILED_GROUP_SIZE      = 16; // GROUP_SIZE_X & _Y of the TILED variants of Bake.cs.hlsl
+
+com_ptr<ID3D12Resource> createResource12(ID3D12Device* device, D3D12_HEAP_TYPE heap_type, const D3D12_RESOURCE_DESC& desc, D3D12_RESOURCE_STATES state)
+{
+    const D3D12_HEAP_PROPERTIES heap = {
+        .Type                 = heap_type,
+        .CPUPageProperty      = D3D12_CPU_PAGE_PROPERTY_UNKNOWN,
+        .MemoryPoolPreference = D3D12_MEMORY_POOL_UNKNOWN,
+        .CreationNodeMask     = 0,
+        .VisibleNodeMask      = 0,
+    };
+    com_ptr<ID3D12Resource> retval = nullptr;
+    DX::ThrowIfFailed(device->CreateCommittedResource(&heap, D3D12_HEAP_FLAG_NONE, &desc, state, nullptr, __uuidof(ID3D12Resource), retval.put_void()));
+    return retval;
+}
+
+D3D12_RESOURCE_DESC bufferDesc12(uint64_t bytes)
+{
+    return {
+        .Dimension        = D3D12_RESOURCE_DIMENSION_BUFFER,
+        .Alignment        = 0,
+        .Width            = bytes,
+        .Height           = 1,
+        .DepthOrArraySize = 1,
+        .MipLevels        = 1,
+        .Format           = DXGI_FORMAT_UNKNOWN,
+        .SampleDesc       = {.Count = 1, .Quality = 0},
+        .Layout           = D3D12_TEXTURE_LAYOUT_ROW_MAJOR,
+        .Flags            = D3D12_RESOURCE_FLAG_NONE,
+    };
+}
+
+D3D12_RESOURCE_DESC texDesc12(uint64_t width, uint32_t height, uint32_t array_size, DXGI_FORMAT format, D3D12_RESOURCE_FLAGS flags = D3D12_RESOURCE_FLAG_NONE)
+{
+    return {
+        .Dimension        = D3D12_RESOURCE_DIMENSION_TEXTURE2D,
+        .Alignment        = 0,
+        .Width            = width,
+        .Height           = height,
+        .DepthOrArraySize = static_cast<UINT16>(array_size),
+        .MipLevels        = 1,
+        .Format           = format,
+        .SampleDesc       = {.Count = 1, .Quality = 0},
+        .Layout           = D3D12_TEXTURE_LAYOUT_UNKNOWN,
+        .Flags            = flags,
+    };
+}
+
+D3D12_RESOURCE_BARRIER transition12(ID3D12Resource* resource, D3D12_RESOURCE_STATES before, D3D12_RESOURCE_STATES after)
+{
+    return {
+        .Type       = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION,
+        .Flags      = D3D12_RESOURCE_BARRIER_FLAG_NONE,
+        .Transition = {.pResource = resource, .Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES, .StateBefore = before, .StateAfter = after},
+    };
+}
+
+// where each slice of a texture goes in a buffer, from base_offset on
+struct Footprints12 {
+    std::vector<D3D12_PLACED_SUBRESOURCE_FOOTPRINT> placed;
+    std::vector<UINT>                               rows;
+    std::vector<UINT64>                             row_bytes;
+    uint64_t                                        end = 0; // just past the last slice
+};
+
+Footprints12 footprints12(ID3D12Device* device, const D3D12_RESOURCE_DESC& desc, uint64_t base_offset = 0)
+{
+    Footprints12 retval;
+    retval.placed.resize(desc.DepthOrArraySize);
+    retval.rows.resize(desc.DepthOrArraySize);
+    retval.row_bytes.resize(desc.DepthOrArraySize);
+
+    UINT64 total = 0;
+    device->GetCopyableFootprints(&desc, 0, desc.DepthOrArraySize, base_offset, retval.placed.data(), retval.rows.data(), retval.row_bytes.data(), &total);
+    retval.end = base_offset + total;
+    return retval;
+}
+
+// a texture array of same-sized images, copied in through an upload buffer on list
+// both are added to resources, which has to outlive the copy
+ID3D12Resource* uploadTexture12(ID3D12Device* device, ID3D12GraphicsCommandList* list, std::span<const DirectX::Image* const> images, std::vector<com_ptr<ID3D12Resource>>& resources)
+{
+    const auto& first      = *images.front();
+    const auto  desc       = texDesc12(first.width, static_cast<uint32_t>(first.height), static_cast<uint32_t>(images.size()), first.format);
+    const auto  footprints = footprints12(device, desc);
+
+    auto tex    = createResource12(device, D3D12_HEAP_TYPE_DEFAULT, desc, D3D12_RESOURCE_STATE_COPY_DEST);
+    auto upload = createResource12(device, D3D12_HEAP_TYPE_UPLOAD, bufferDesc12(footprints.end), D3D12_RESOURCE_STATE_GENERIC_READ);
+
+    uint8_t* mapped = nullptr;
+    DX::ThrowIfFailed(upload->Map(0, nullptr, reinterpret_cast<void**>(&mapped)));
+    for (UINT i = 0; i < images.size(); ++i) {
+        const auto& placed = footprints.placed[i];
+        for (UINT row = 0; row < footprints.rows[i]; ++row)
+            std::memcpy(mapped + placed.Offset + (row * placed.Footprint.RowPitch), images[i]->pixels + (row * images[i]->rowPitch), footprints.row_bytes[i]);
+
+        const D3D12_TEXTURE_COPY_LOCATION dst = {.pResource = tex.get(), .Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX, .SubresourceIndex = i};
+        const D3D12_TEXTURE_COPY_LOCATION src = {.pResource = upload.get(), .Type = D3D12_TEXTURE_COPY_TYPE_PLACED_FOOTPRINT, .PlacedFootprint = placed};
+        list->CopyTextureRegion(&dst, 0, 0, 0, &src, nullptr);
+    }
+    upload->Unmap(0, nullptr);
+
+    resources.push_back(upload);
+    resources.push_back(tex);
+    return tex.get();
+}
+
+// copies the slices of a mapped read back buffer into an image of the same layout
+HRESULT readbackImage12(const uint8_t* mapped, const D3D12_RESOURCE_DESC& desc, const Footprints12& footprints, DirectX::ScratchImage& image)
+{
+    HRESULT hr = image.Initialize2D(desc.Format, static_cast<size_t>(desc.Width), desc.Height, desc.DepthOrArraySize, 1);
+    for (UINT i = 0; SUCCEEDED(hr) && i < desc.DepthOrArraySize; ++i) {
+        const auto* img    = image.GetImage(0, i, 0);
+        const auto& placed = footprints.placed[i];
+        for (UINT row = 0; row < footprints.rows[i]; ++row)
+            std::memcpy(img->pixels + (row * img->rowPitch), mapped + placed.Offset + (row * placed.Footprint.RowPitch), footprints.row_bytes[i]);
+    }
+    return hr;
+}
+} // namespace
+
+HRESULT initDevice12(D3dObjs& d3d, const Arguments& args, IDXGIAdapter* adapter)
+{
+    auto& d3d12 = d3d.d3d12;
+
+    HRESULT hr = D3D12CreateDevice(adapter, D3D_FEATURE_LEVEL_11_0, __uuidof(ID3D12Device), d3d12.device.put_void());
+    if (FAILED(hr)) {
+        spdlog::error("Failed to create ID3D12Device");
+        return hr;
+    }
+    auto* device = d3d12.device.get();
+
+    for (auto [type, queue] : {std::pair{D3D12_COMMAND_LIST_TYPE_COMPUTE, &d3d12.compute_queue}, std::pair{D3D12_COMMAND_LIST_TYPE_COPY, &d3d12.copy_queue}}) {
+        const D3D12_COMMAND_QUEUE_DESC queue_desc = {.Type = type, .Priority = D3D12_COMMAND_QUEUE_PRIORITY_NORMAL, .Flags = D3D12_COMMAND_QUEUE_FLAG_NONE, .NodeMask = 0};
+        DX::ThrowIfFailed(device->CreateCommandQueue(&queue_desc, __uuidof(ID3D12CommandQueue), queue->put_void()));
+    }
+    DX::ThrowIfFailed(device->CreateFence(0, D3D12_FENCE_FLAG_NONE, __uuidof(ID3D12Fence), d3d12.baked_fence.put_void()));
+    DX::ThrowIfFailed(device->CreateFence(0, D3D12_FENCE_FLAG_NONE, __uuidof(ID3D12Fence), d3d12.copied_fence.put_void()));
+
+    // b0 as a root cbv so every light of the per light kernel points at its own constants, the textures as tables
+    const D3D12_DESCRIPTOR_RANGE ranges[] = {
+        {.RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_SRV, .NumDescriptors = SRV_TABLE_SIZE, .BaseShaderRegister = 0, .RegisterSpace = 0, .OffsetInDescriptorsFromTableStart = 0},
+        {.RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_UAV, .NumDescriptors = UAV_TABLE_SIZE, .BaseShaderRegister = 0, .RegisterSpace = 0, .OffsetInDescriptorsFromTableStart = 0},
+    };
+    const D3D12_ROOT_PARAMETER params[] = {
+        {.ParameterType = D3D12_ROOT_PARAMETER_TYPE_CBV, .Descriptor = {.ShaderRegister = 0, .RegisterSpace = 0}, .ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL},
+        {.ParameterType = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE, .DescriptorTable = {.NumDescriptorRanges = 1, .pDescriptorRanges = &ranges[0]}, .ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL},
+        {.ParameterType = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE, .DescriptorTable = {.NumDescriptorRanges = 1, .pDescriptorRanges = &ranges[1]}, .ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL},
+    };
+    const D3D12_ROOT_SIGNATURE_DESC root_desc = {
+        .NumParameters     = ARRAYSIZE(params),
+        .pParameters       = params,
+        .NumStaticSamplers = 0,
+        .pStaticSamplers   = nullptr,
+        .Flags             = D3D12_ROOT_SIGNATURE_FLAG_NONE,
+    };
+
+    com_ptr<ID3DBlob> root_blob   = nullptr;
+    com_ptr<ID3DBlob> root_errors = nullptr;
+    hr                            = D3D12SerializeRootSignature(&root_desc, D3D_ROOT_SIGNATURE_VERSION_1, root_blob.put(), root_errors.put());
+    if (FAILED(hr)) {
+        spdlog::error("Failed to serialize the root signature:\n\n{}", root_errors ? static_cast<char*>(root_errors->GetBufferPointer()) : "Unknown error");
+        return hr;
+    }
+    DX::ThrowIfFailed(device->CreateRootSignature(0, root_blob->GetBufferPointer(), root_blob->GetBufferSize(), __uuidof(ID3D12RootSignature), d3d12.root_signature.put_void()));
+
+    const auto create_pso = [&](const char* filename, std::span<const BYTE> bytecode, const D3D_SHADER_MACRO* defines, com_ptr<ID3D12PipelineState>& pso) {
+        com_ptr<ID3DBlob> shader_blob = nullptr;
+        bytecode                      = shaderBytecode(args.shader_dir, filename, bytecode, d3d.shader_hash, defines, shader_blob);
+        if (bytecode.empty())
+            return E_FAIL;
+
+        const D3D12_COMPUTE_PIPELINE_STATE_DESC pso_desc = {
+            .pRootSignature = d3d12.root_signature.get(),
+            .CS             = {.pShaderBytecode = bytecode.data(), .BytecodeLength = bytecode.size()},
+            .NodeMask       = 0,
+            .CachedPSO      = {.pCachedBlob = nullptr, .CachedBlobSizeInBytes = 0},
+            .Flags          = D3D12_PIPELINE_STATE_FLAG_NONE,
+        };
+        HRESULT pso_hr = device->CreateComputePipelineState(&pso_desc, __uuidof(ID3D12PipelineState), pso.put_void());
+        if (FAILED(pso_hr))
+            spdlog::error("Failed to create compute pipeline from {}", filename);
+        return pso_hr;
+    };
+
+    // batched sets use the tiled kernel where the device runs shader model 6, else the cs_5_0 one
+    // compiled from --shader-dir it goes through fxc at cs_5_0, groupshared memory needs nothing newer
+    D3D12_FEATURE_DATA_SHADER_MODEL shader_model = {.HighestShaderModel = D3D_SHADER_MODEL_6_0};
+    const bool                      sm6          = SUCCEEDED(device->CheckFeatureSupport(D3D12_FEATURE_SHADER_MODEL, &shader_model, sizeof(shader_model))) &&
+                             shader_model.HighestShaderModel >= D3D_SHADER_MODEL_6_0;
+    const bool tiled = args.batched && sm6;
+    if (args.batched && !tiled)
+        spdlog::info("{}Shader model 6 is not supported, using the cs_5_0 bake kernel", d3d.label);
+
+    // --sh-order 1 swaps in the L1 variants
+    const bool l1         = args.sh_order == 1;
+    const auto group_size = std::to_string(TILED_GROUP_SIZE);
+    if (tiled) {
+        const auto defines = args.group_faces ? bakeDefines(args, {{"BATCHED", "1"}, {"FACES", "1"}, {"TILED", "1"}, {"GROUP_SIZE_X", group_size.c_str()}, {"GROUP_SIZE_Y", group_size.c_str()}})
+                                              : bakeDefines(args, {{"BATCHED", "1"}, {"TILED", "1"}, {"GROUP_SIZE_X", group_size.c_str()}, {"GROUP_SIZE_Y", group_size.c_str()}});
+        auto       bytecode = l1 ? std::span<const BYTE>(g_Bake_BATCHED_TILED_L1_SM6) : std::span<const BYTE>(g_Bake_BATCHED_TILED_SM6);
+        if (args.group_faces)
+            bytecode = l1 ? std::span<const BYTE>(g_Bake_BATCHED_FACES_TILED_L1_SM6) : std::span<const BYTE>(g_Bake_BATCHED_FACES_TILED_SM6);
+        hr                    = create_pso("Bake.cs.hlsl", bytecode, defines.data(), d3d12.bake_pso);
+        d3d12.bake_group_size = TILED_GROUP_SIZE;
+    } else if (args.group_faces) {
+        hr = create_pso("Bake.cs.hlsl", l1 ? std::span<const BYTE>(g_Bake_BATCHED_FACES_L1) : std::span<const BYTE>(g_Bake_BATCHED_FACES),
+                        bakeDefines(args, {{"BATCHED", "1"}, {"FACES", "1"}}).data(), d3d12.bake_pso);
+    } else if (args.batched) {
+        hr = create_pso("Bake.cs.hlsl", l1 ? std::span<const BYTE>(g_Bake_BATCHED_L1) : std::span<const BYTE>(g_Bake_BATCHED), bakeDefines(args, {{"BATCHED", "1"}}).data(), d3d12.bake_pso);
+    } else {
+        hr = create_pso("Bake.cs.hlsl", l1 ? std::span<const BYTE>(g_Bake_L1) : std::span<const BYTE>(g_Bake), bakeDefines(args).data(), d3d12.bake_pso);
+    }
+    if (SUCCEEDED(hr) && !args.validation_dir.empty())
+        hr = create_pso("Validation.cs.hlsl", g_Validation, nullptr, d3d12.validation_pso);
+    if (FAILED(hr))
+        return hr;
+
+    D3D12_DESCRIPTOR_HEAP_DESC heap_desc = {
+        .Type           = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV,
+        .NumDescriptors = args.staging_count * DESCRIPTORS_PER_FRAME,
+        .Flags          = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE,
+        .NodeMask       = 0,
+    };
+    DX::ThrowIfFailed(device->CreateDescriptorHeap(&heap_desc, __uuidof(ID3D12DescriptorHeap), d3d12.heap.put_void()));
+    heap_desc.NumDescriptors = args.staging_count;
+    heap_desc.Flags          = D3D12_DESCRIPTOR_HEAP_FLAG_NONE;
+    DX::ThrowIfFailed(device->CreateDescriptorHeap(&heap_desc, __uuidof(ID3D12DescriptorHeap), d3d12.clear_heap.put_void()));
+    d3d12.descriptor_size = device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+
+    return S_OK;
+}
+
+namespace {
+// a set in flight on the d3d12 queues, the frame is reused once the set is read back
+struct D3d12Frame {
+    com_ptr<ID3D12CommandAllocator>    compute_allocator = nullptr;
+    com_ptr<ID3D12CommandAllocator>    copy_allocator    = nullptr;
+    com_ptr<ID3D12GraphicsCommandList> compute_list      = nullptr;
+    com_ptr<ID3D12GraphicsCommandList> copy_list         = nullptr;
+
+    std::vector<com_ptr<ID3D12Resource>> inputs; // textures, upload buffers & constants, dropped once read back
+    com_ptr<ID3D12Resource>              sh_coeffs = nullptr; // kept while sets have the same size
+    com_ptr<ID3D12Resource>              valid_tex = nullptr; // --validation-dir only
+    com_ptr<ID3D12Resource>              readback  = nullptr; // sh, then valid
+
+    std::string       key;
+    PackInfo          pack_info   = {};
+    DirectX::XMFLOAT3 light_dir   = {}; // of the validation image
+    uint64_t          fence_value = 0;  // of the read back, 0 = idle
+};
+
+// waits for the frame's read back and queues its images for saving
+HRESULT finishFrame12(D3dObjs& d3d, const Arguments& args, Profiler& profiler, SavePipeline& save_pipeline, D3d12Frame& frame)
+{
+    auto& d3d12 = d3d.d3d12;
+
+    DirectX::ScratchImage sh_image;
+    DirectX::ScratchImage valid_image;
+    HRESULT               hr = S_OK;
+    {
+        ScopedTimer timer(profiler, frame.key, Stage::kReadback); // includes waiting for both queues
+
+        // a null event blocks until the fence is reached
+        hr                = d3d12.copied_fence->SetEventOnCompletion(frame.fence_value, nullptr);
+        frame.fence_value = 0;
+        frame.inputs.clear();
+
+        uint8_t* mapped = nullptr;
+        if (SUCCEEDED(hr))
+            hr = frame.readback->Map(0, nullptr, reinterpret_cast<void**>(&mapped));
+        if (SUCCEEDED(hr)) {
+            const auto sh_desc       = frame.sh_coeffs->GetDesc();
+            const auto sh_footprints = footprints12(d3d12.device.get(), sh_desc);
+            hr                       = readbackImage12(mapped, sh_desc, sh_footprints, sh_image);
+            if (SUCCEEDED(hr) && !args.validation_dir.empty()) {
+                const auto valid_desc = frame.valid_tex->GetDesc();
+                hr                    = readbackImage12(mapped, valid_desc, footprints12(d3d12.device.get(), valid_desc, sh_footprints.end), valid_image);
+            }
+            const D3D12_RANGE written = {.Begin = 0, .End = 0};
+            frame.readback->Unmap(0, &written);
+        }
+    }
+    if (FAILED(hr)) {
+        spdlog::error("\t{}Failed to read back texture set \"{}\"", d3d.label, frame.key);
+        return hr;
+    }
+
+    save_pipeline.enqueueImage(std::move(sh_image), frame.key, args.out_dir / std::format("{}_sh.dds", frame.key), true, frame.pack_info);
+    if (!args.validation_dir.empty()) {
+        const auto& light_dir = frame.light_dir;
+        save_pipeline.enqueueImage(std::move(valid_image), frame.key,
+                                   args.validation_dir / std::format("{}_{:.2f}_{:.2f}_{:.2f}_re.dds", frame.key, light_dir.x, light_dir.y, light_dir.z), false);
+    }
+    return S_OK;
+}
+
+// records & submits a set, the bake on the compute queue, its read back on the copy queue once the bake's fence is reached
+void submitFrame12(D3dObjs& d3d, const Arguments& args, D3d12Frame& frame, uint32_t frame_idx, const InputTexSet& tex_set, const SetImages& images)
+{
+    auto& d3d12  = d3d.d3d12;
+    auto* device = d3d12.device.get();
+
+    const auto width       = tex_set.tr.width;
+    const auto height      = tex_set.tr.height;
+    const auto face_count  = static_cast<uint32_t>(std::max<size_t>(1, tex_set.faces.size()));
+    const auto light_count = static_cast<uint32_t>(tex_set.colors.size() / face_count);
+    const auto lights      = std::span(tex_set.colors).first(light_count);
+
+    DX::ThrowIfFailed(frame.compute_allocator->Reset());
+    auto* list = frame.compute_list.get();
+    DX::ThrowIfFailed(list->Reset(frame.compute_allocator.get(), nullptr));
+
+    // Inputs
+    std::vector<const DirectX::Image*> color_images;
+    for (auto const& color : images.colors)
+        color_images.push_back(&color.image);
+    std::vector<const DirectX::Image*> tr_images;
+    if (images.face_trs.empty())
+        tr_images.push_back(&images.tr.image);
+    for (auto const& tr : images.face_trs)
+        tr_images.push_back(&tr.image);
+
+    auto* colors_tex = uploadTexture12(device, list, color_images, frame.inputs);
+    auto* tr_tex     = uploadTexture12(device, list, tr_images, frame.inputs);
+
+    // like initBatchedInputs()
+    std::vector<DirectX::XMFLOAT4> light_dirs;
+    light_dirs.reserve(light_count);
+    for (auto const& color : lights)
+        light_dirs.push_back({color.light_direction.x, color.light_direction.y, color.light_direction.z, static_cast<float>(color.count)});
+    auto& light_dirs_buf = frame.inputs.emplace_back(createResource12(device, D3D12_HEAP_TYPE_UPLOAD, bufferDesc12(sizeof(DirectX::XMFLOAT4) * light_count), D3D12_RESOURCE_STATE_GENERIC_READ));
+    {
+        void* mapped = nullptr;
+        DX::ThrowIfFailed(light_dirs_buf->Map(0, nullptr, &mapped));
+        std::memcpy(mapped, light_dirs.data(), sizeof(DirectX::XMFLOAT4) * light_count);
+        light_dirs_buf->Unmap(0, nullptr);
+    }
+
+    // one entry per dispatch, the last one holds the last light for validation
+    const BakeCBData set_cb_data = {
+        .weight      = unitWeight(lights),
+        .face        = tex_set.face,
+        .light_count = light_count,
+        .faces       = packFaces(tex_set.faces),
+        .face_dims   = {width, height},
+    };
+    std::vector<BakeCBData> cb_data(args.batched ? 1 : light_count, set_cb_data);
+    for (uint32_t i = 0; i < cb_data.size(); ++i) {
+        cb_data[i].light_dir = args.batched ? lights.back().light_direction : lights[i].light_direction;
+        cb_data[i].slice     = i;
+        if (!args.batched)
+            cb_data[i].weight *= static_cast<float>(lights[i].count);
+    }
+    auto& cb_buf = frame.inputs.emplace_back(createResource12(device, D3D12_HEAP_TYPE_UPLOAD, bufferDesc12(CB_STRIDE * cb_data.size()), D3D12_RESOURCE_STATE_GENERIC_READ));
+    {
+        uint8_t* mapped = nullptr;
+        DX::ThrowIfFailed(cb_buf->Map(0, nullptr, reinterpret_cast<void**>(&mapped)));
+        for (size_t i = 0; i < cb_data.size(); ++i)
+            std::memcpy(mapped + (i * CB_STRIDE), &cb_data[i], sizeof(BakeCBData));
+        cb_buf->Unmap(0, nullptr);
+    }
+
+    // Outputs, recreated when the size changes
+    const auto same_size = [](ID3D12Resource* tex, const D3D12_RESOURCE_DESC& desc) {
+        const auto tex_desc = tex->GetDesc();
+        return tex_desc.Width == desc.Width && tex_desc.Height == desc.Height && tex_desc.DepthOrArraySize == desc.DepthOrArraySize && tex_desc.Format == desc.Format;
+    };
+    const auto sh_slices = shSlices(args.sh_order) * face_count;
+    const auto sh_desc   = texDesc12(width, height, sh_slices, args.sh_format, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
+    if (frame.sh_coeffs == nullptr || !same_size(frame.sh_coeffs.get(), sh_desc)) {
+        frame.sh_coeffs = createResource12(device, D3D12_HEAP_TYPE_DEFAULT, sh_desc, D3D12_RESOURCE_STATE_COMMON);
+        frame.readback  = nullptr;
+    }
+    const auto valid_desc = texDesc12(width, height, 1, DXGI_FORMAT_R32_FLOAT, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
+    if (!args.validation_dir.empty() && (frame.valid_tex == nullptr || !same_size(frame.valid_tex.get(), valid_desc))) {
+        frame.valid_tex = createResource12(device, D3D12_HEAP_TYPE_DEFAULT, valid_desc, D3D12_RESOURCE_STATE_COMMON);
+        frame.readback  = nullptr;
+    }
+    const auto sh_footprints    = footprints12(device, sh_desc);
+    const auto valid_footprints = args.validation_dir.empty() ? Footprints12{.end = sh_footprints.end} : footprints12(device, valid_desc, sh_footprints.end);
+    if (frame.readback == nullptr)
+        frame.readback = createResource12(device, D3D12_HEAP_TYPE_READBACK, bufferDesc12(valid_footprints.end), D3D12_RESOURCE_STATE_COPY_DEST);
+
+    // Descriptors, bake then validation tables, unused slots get null views
+    const auto cpu_at = [&](UINT idx) {
+        auto handle = d3d12.heap->GetCPUDescriptorHandleForHeapStart();
+        handle.ptr += static_cast<SIZE_T>((frame_idx * DESCRIPTORS_PER_FRAME) + idx) * d3d12.descriptor_size;
+        return handle;
+    };
+    const auto gpu_at = [&](UINT idx) {
+        auto handle = d3d12.heap->GetGPUDescriptorHandleForHeapStart();
+        handle.ptr += static_cast<UINT64>((frame_idx * DESCRIPTORS_PER_FRAME) + idx) * d3d12.descriptor_size;
+        return handle;
+    };
+    const auto tex_srv = [](DXGI_FORMAT format, uint32_t array_size, bool is_array) {
+        D3D12_SHADER_RESOURCE_VIEW_DESC desc = {.Format = format, .ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D, .Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING};
+        if (is_array) {
+            desc.ViewDimension  = D3D12_SRV_DIMENSION_TEXTURE2DARRAY;
+            desc.Texture2DArray = {.MostDetailedMip = 0, .MipLevels = 1, .FirstArraySlice = 0, .ArraySize = array_size, .PlaneSlice = 0, .ResourceMinLODClamp = 0.F};
+        } else {
+            desc.Texture2D = {.MostDetailedMip = 0, .MipLevels = 1, .PlaneSlice = 0, .ResourceMinLODClamp = 0.F};
+        }
+        return desc;
+    };
+    const auto tex_uav = [](DXGI_FORMAT format, uint32_t array_size, bool is_array) {
+        D3D12_UNORDERED_ACCESS_VIEW_DESC desc = {.Format = format, .ViewDimension = D3D12_UAV_DIMENSION_TEXTURE2D, .Texture2D = {.MipSlice = 0, .PlaneSlice = 0}};
+        if (is_array) {
+            desc.ViewDimension  = D3D12_UAV_DIMENSION_TEXTURE2DARRAY;
+            desc.Texture2DArray = {.MipSlice = 0, .FirstArraySlice = 0, .ArraySize = array_size, .PlaneSlice = 0};
+        }
+        return desc;
+    };
+    const auto null_srv = tex_srv(DXGI_FORMAT_R32_FLOAT, 1, false);
+    const auto null_uav = tex_uav(DXGI_FORMAT_R32_FLOAT, 1, false);
+
+    const auto colors_srv     = tex_srv(tex_set.colors.front().format, static_cast<uint32_t>(tex_set.colors.size()), true);
+    const auto tr_srv         = tex_srv(tex_set.tr.format, face_count, !tex_set.faces.empty());
+    const auto sh_srv         = tex_srv(args.sh_format, sh_slices, true);
+    const auto sh_uav         = tex_uav(args.sh_format, sh_slices, true);
+    const auto valid_uav      = tex_uav(DXGI_FORMAT_R32_FLOAT, 1, false);
+    const auto light_dirs_srv = D3D12_SHADER_RESOURCE_VIEW_DESC{
+        .Format                  = DXGI_FORMAT_UNKNOWN,
+        .ViewDimension           = D3D12_SRV_DIMENSION_BUFFER,
+        .Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING,
+        .Buffer                  = {.FirstElement = 0, .NumElements = light_count, .StructureByteStride = sizeof(DirectX::XMFLOAT4), .Flags = D3D12_BUFFER_SRV_FLAG_NONE},
+    };
+
+    constexpr UINT BAKE_TABLES  = 0;
+    constexpr UINT VALID_TABLES = SRV_TABLE_SIZE + UAV_TABLE_SIZE;
+
+    device->CreateShaderResourceView(colors_tex, &colors_srv, cpu_at(BAKE_TABLES + 0));
+    device->CreateShaderResourceView(tr_tex, &tr_srv, cpu_at(BAKE_TABLES + 1));
+    device->CreateShaderResourceView(light_dirs_buf.get(), &light_dirs_srv, cpu_at(BAKE_TABLES + 2));
+    device->CreateShaderResourceView(nullptr, &null_srv, cpu_at(BAKE_TABLES + 3));
+    device->CreateShaderResourceView(nullptr, &null_srv, cpu_at(BAKE_TABLES + 4));
+    device->CreateUnorderedAccessView(frame.sh_coeffs.get(), nullptr, &sh_uav, cpu_at(BAKE_TABLES + SRV_TABLE_SIZE));
+    device->CreateUnorderedAccessView(nullptr, nullptr, &null_uav, cpu_at(BAKE_TABLES + SRV_TABLE_SIZE + 1));
+    if (!args.validation_dir.empty()) {
+        device->CreateShaderResourceView(frame.sh_coeffs.get(), &sh_srv, cpu_at(VALID_TABLES + 0));
+        device->CreateShaderResourceView(tr_tex, &tr_srv, cpu_at(VALID_TABLES + 1));
+        for (UINT i = 2; i < SRV_TABLE_SIZE; ++i)
+            device->CreateShaderResourceView(nullptr, &null_srv, cpu_at(VALID_TABLES + i));
+        device->CreateUnorderedAccessView(frame.valid_tex.get(), nullptr, &valid_uav, cpu_at(VALID_TABLES + SRV_TABLE_SIZE));
+        device->CreateUnorderedAccessView(nullptr, nullptr, &null_uav, cpu_at(VALID_TABLES + SRV_TABLE_SIZE + 1));
+    }
+
+    // Dispatch
+    {
+        const std::array barriers = {
+            transition12(colors_tex, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE),
+            transition12(tr_tex, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE),
+            transition12(frame.sh_coeffs.get(), D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_UNORDERED_ACCESS),
+        };
+        list->ResourceBarrier(barriers.size(), barriers.data());
+    }
+
+    auto* heap = d3d12.heap.get();
+    list->SetDescriptorHeaps(1, &heap);
+    list->SetComputeRootSignature(d3d12.root_signature.get());
+    list->SetPipelineState(d3d12.bake_pso.get());
+    list->SetComputeRootDescriptorTable(1, gpu_at(BAKE_TABLES));
+    list->SetComputeRootDescriptorTable(2, gpu_at(BAKE_TABLES + SRV_TABLE_SIZE));
+
+    const D3D12_RESOURCE_BARRIER uav_barrier = {.Type = D3D12_RESOURCE_BARRIER_TYPE_UAV, .Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE, .UAV = {.pResource = frame.sh_coeffs.get()}};
+    if (!args.batched) {
+        // the per light kernel accumulates
+        auto clear_cpu = d3d12.clear_heap->GetCPUDescriptorHandleForHeapStart();
+        clear_cpu.ptr += static_cast<SIZE_T>(frame_idx) * d3d12.descriptor_size;
+        device->CreateUnorderedAccessView(frame.sh_coeffs.get(), nullptr, &sh_uav, clear_cpu);
+
+        const float values[4] = {0, 0, 0, 0};
+        list->ClearUnorderedAccessViewFloat(gpu_at(BAKE_TABLES + SRV_TABLE_SIZE), clear_cpu, frame.sh_coeffs.get(), values, 0, nullptr);
+        list->ResourceBarrier(1, &uav_barrier);
+    }
+    for (size_t i = 0; i < cb_data.size(); ++i) {
+        // every light reads what the one before it wrote
+        if (i > 0)
+            list->ResourceBarrier(1, &uav_barrier);
+        list->SetComputeRootConstantBufferView(0, cb_buf->GetGPUVirtualAddress() + (i * CB_STRIDE));
+        list->Dispatch((width + d3d12.bake_group_size - 1) / d3d12.bake_group_size, (height + d3d12.bake_group_size - 1) / d3d12.bake_group_size, face_count);
+    }
+
+    if (!args.validation_dir.empty()) {
+        {
+            const std::array barriers = {
+                transition12(frame.sh_coeffs.get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE),
+                transition12(frame.valid_tex.get(), D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_UNORDERED_ACCESS),
+            };
+            list->ResourceBarrier(barriers.size(), barriers.data());
+        }
+        list->SetPipelineState(d3d12.validation_pso.get());
+        list->SetComputeRootDescriptorTable(1, gpu_at(VALID_TABLES));
+        list->SetComputeRootDescriptorTable(2, gpu_at(VALID_TABLES + SRV_TABLE_SIZE));
+        list->Dispatch((width + 7) / 8, (height + 7) / 8, 1);
+
+        const std::array barriers = {
+            transition12(frame.sh_coeffs.get(), D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_COMMON),
+            transition12(frame.valid_tex.get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COMMON),
+        };
+        list->ResourceBarrier(barriers.size(), barriers.data());
+    } else {
+        const auto barrier = transition12(frame.sh_coeffs.get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COMMON);
+        list->ResourceBarrier(1, &barrier);
+    }
+    DX::ThrowIfFailed(list->Close());
+
+    const auto fence_value = ++d3d12.fence_value;
+    {
+        ID3D12CommandList* lists[] = {list};
+        d3d12.compute_queue->ExecuteCommandLists(1, lists);
+        DX::ThrowIfFailed(d3d12.compute_queue->Signal(d3d12.baked_fence.get(), fence_value));
+    }
+
+    // Read back, outputs are promoted from & decay back to common on the copy queue
+    DX::ThrowIfFailed(frame.copy_allocator->Reset());
+    auto* copy_list = frame.copy_list.get();
+    DX::ThrowIfFailed(copy_list->Reset(frame.copy_allocator.get(), nullptr));
+    const auto copy_slices = [&](ID3D12Resource* tex, const Footprints12& footprints) {
+        for (UINT i = 0; i < footprints.placed.size(); ++i) {
+            const D3D12_TEXTURE_COPY_LOCATION dst = {.pResource = frame.readback.get(), .Type = D3D12_TEXTURE_COPY_TYPE_PLACED_FOOTPRINT, .PlacedFootprint = footprints.placed[i]};
+            const D3D12_TEXTURE_COPY_LOCATION src = {.pResource = tex, .Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX, .SubresourceIndex = i};
+            copy_list->CopyTextureRegion(&dst, 0, 0, 0, &src, nullptr);
+        }
+    };
+    copy_slices(frame.sh_coeffs.get(), sh_footprints);
+    if (!args.validation_dir.empty())
+        copy_slices(frame.valid_tex.get(), valid_footprints);
+    DX::ThrowIfFailed(copy_list->Close());
+
+    DX::ThrowIfFailed(d3d12.copy_queue->Wait(d3d12.baked_fence.get(), fence_value));
+    {
+        ID3D12CommandList* lists[] = {copy_list};
+        d3d12.copy_queue->ExecuteCommandLists(1, lists);
+        DX::ThrowIfFailed(d3d12.copy_queue->Signal(d3d12.copied_fence.get(), fence_value));
+    }
+
+    frame.pack_info   = packInfo(tex_set);
+    frame.light_dir   = lights.back().light_direction;
+    frame.fence_value = fence_value;
+}
+
+// bakeOnDevice for --backend d3d12, sets go round robin through the frames, taking a frame waits for its previous set's read back
+HRESULT bakeOnD3d12(D3dObjs& d3d, const Arguments& args, Profiler& profiler, std::unordered_map<std::string, InputTexSet>& tex_inputs, SetQueue& queue, std::vector<std::string>& baked_keys, PackWriter* pack)
+{
+    auto&        d3d12 = d3d.d3d12;
+    SavePipeline save_pipeline(nullptr, nullptr, profiler, 0, args.writer_threads, args.max_pending_writes, pack);
+
+    std::vector<D3d12Frame> frames(args.staging_count);
+    for (auto& frame : frames) {
+        for (auto [type, allocator, list] : {std::tuple{D3D12_COMMAND_LIST_TYPE_COMPUTE, &frame.compute_allocator, &frame.compute_list},
+                                             std::tuple{D3D12_COMMAND_LIST_TYPE_COPY, &frame.copy_allocator, &frame.copy_list}}) {
+            DX::ThrowIfFailed(d3d12.device->CreateCommandAllocator(type, __uuidof(ID3D12CommandAllocator), allocator->put_void()));
+            DX::ThrowIfFailed(d3d12.device->CreateCommandList(0, type, allocator->get(), nullptr, __uuidof(ID3D12GraphicsCommandList), list->put_void()));
+            DX::ThrowIfFailed((*list)->Close()); // reset before each set
+        }
+    }
+    spdlog::info("{}Baking on d3d12 with {} sets in flight", d3d.label, frames.size());
+
+    std::vector<std::string> baked; // handed to baked_keys once all saves went through
+    size_t                   next_frame = 0;
+
+    const auto finish = [&](D3d12Frame& frame) {
+        if (frame.fence_value == 0)
+            return;
+        if (SUCCEEDED(finishFrame12(d3d, args, profiler, save_pipeline, frame))) {
+            baked.push_back(frame.key);
+            spdlog::info("\t{}Done \"{}\"", d3d.label, frame.key);
+        }
+    };
+
+    // Process
+    std::future<SetImages> next_images;
+    for (const auto* next_key = queue.pop(); next_key != nullptr;) {
+        const auto& key     = *next_key;
+        auto&       tex_set = tex_inputs.at(key);
+        next_key            = queue.pop(); // claimed now, so it can be read while this one bakes
+        spdlog::info("{}Processing texture set \"{}\" ...", d3d.label, key);
+
+        auto images = next_images.valid() ? next_images.get() : readSetImages(key, tex_set, args.io_threads, args.mmap, profiler);
+        if (next_key != nullptr) {
+            const auto& next_set = tex_inputs.at(*next_key);
+            next_images          = std::async(std::launch::async, [&args, &profiler, next_key, &next_set]() { return readSetImages(*next_key, next_set, args.io_threads, args.mmap, profiler); });
+        }
+        if (FAILED(images.hr) || tex_set.colors.size() > D3D12_REQ_TEXTURE2D_ARRAY_AXIS_DIMENSION) {
+            spdlog::warn("\t{}Failed to upload texture set \"{}\". Skipping the whole set", d3d.label, key);
+            continue;
+        }
+
+        // oldest first, its read back has had the most time
+        const auto frame_idx = static_cast<uint32_t>(next_frame);
+        auto&      frame     = frames[frame_idx];
+        next_frame           = (next_frame + 1) % frames.size();
+        finish(frame);
+
+        ScopedTimer timer(profiler, key, Stage::kUpload);
+        frame.key = key;
+        submitFrame12(d3d, args, frame, frame_idx, tex_set, images);
+    }
+    for (size_t i = 0; i < frames.size(); ++i)
+        finish(frames[(next_frame + i) % frames.size()]);
+
+    const auto hr = save_pipeline.finish();
+    if (SUCCEEDED(hr))
+        baked_keys = std::move(baked);
+    return hr;
+}
+} // namespace
+
+HRESULT bakeOnDevice(D3dObjs& d3d, const Arguments& args, Profiler& profiler, std::unordered_map<std::string, InputTexSet>& tex_inputs, SetQueue& queue, std::vector<std::string>& baked_keys, PackWriter* pack)
+{
+    if (args.backend == Backend::kD3d12)
+        return bakeOnD3d12(d3d, args, profiler, tex_inputs, queue, baked_keys, pack);
+
+    SavePipeline save_pipeline(d3d.device.get(), d3d.context.get(), profiler, args.staging_count, args.writer_threads, args.max_pending_writes, pack, &d3d.readback_pools);
+
+    // Concurrent sets
+    constexpr uint32_t MAX_AUTO_CONCURRENT_SETS = 8;
+
+    uint32_t max_jobs    = args.concurrent_sets;
+    uint64_t jobs_budget = std::numeric_limits<uint64_t>::max();
+    if (args.concurrent_sets == 0 && args.backend == Backend::kGpu) {
+        // leave half to the driver, staging & everything else
+        jobs_budget = freeVideoMemory(d3d.device) / 2;
+        max_jobs    = (jobs_budget > 0) ? MAX_AUTO_CONCURRENT_SETS : 1;
+        if (jobs_budget > 0)
+            spdlog::info("{}Baking up to {} sets at once within {} MiB", d3d.label, max_jobs, jobs_budget >> 20);
+        else
+            spdlog::warn("{}Failed to query free video memory, baking one set at a time", d3d.label);
+    }
+
+    if (args.backend == Backend::kGpu) {
+        d3d.job_buffers.resize(max_jobs);
+        d3d.job_buffers[0] = d3d.common_buffer;
+        for (auto& buffer : d3d.job_buffers | std::views::drop(1))
+            DX::ThrowIfFailed(initConstantBuffer(d3d.device.get(), buffer));
+    } else {
+        spdlog::info("Baking on the cpu with {} threads", args.cpu_threads);
+    }
+
+    std::vector<BakeJob>     jobs;
+    uint64_t                 jobs_bytes = 0;
+    std::vector<std::string> baked; // handed to baked_keys once all saves went through
+
+    const bool share_trs = args.dedup && args.backend == Backend::kGpu; // see D3dObjs::shared_tr
+
+    auto flush_jobs = [&]() {
+        if (jobs.empty())
+            return;
+        bakeSets(d3d, args, save_pipeline, profiler, jobs);
+
+        // the gpu keeps the inputs alive until the queued work is done
+        for (auto const& job : jobs) {
+            releaseSet(tex_inputs.at(job.key));
+            baked.push_back(job.key);
+        }
+        if (jobs.size() > 1)
+            spdlog::info("\t{}Done, baked {} sets at once", d3d.label, jobs.size());
+        else
+            spdlog::info("\t{}Done", d3d.label);
+        jobs.clear();
+        jobs_bytes = 0;
+    };
+
+    // Process
+    std::future<SetImages> next_images;
+    for (const auto* next_key = queue.pop(); next_key != nullptr;) {
+        const auto& key     = *next_key;
+        auto&       tex_set = tex_inputs.at(key);
+        next_key            = queue.pop(); // claimed now, so it can be read while this one bakes
+        spdlog::info("{}Processing texture set \"{}\" ...", d3d.label, key);
+
+        if (args.tile_size > 0) {
+            if (FAILED(bakeTiled(d3d, args, profiler, key, tex_set))) {
+                spdlog::error("\t{}Failed to bake texture set \"{}\"", d3d.label, key);
+            } else {
+                baked.push_back(key);
+                spdlog::info("\t{}Done", d3d.label);
+            }
+            continue;
+        }
+
+        if (args.tolerance > 0) {
+            if (FAILED(bakeProgressive(d3d, args, profiler, save_pipeline, key, tex_set))) {
+                spdlog::error("\t{}Failed to bake texture set \"{}\"", d3d.label, key);
+            } else {
+                baked.push_back(key);
+                spdlog::info("\t{}Done", d3d.label);
+            }
+            continue;
+        }
+
+        // read while the previous set baked, the next one gets read while this one does
+        // a tr shared with the set before is not read again, see --dedup
+        const bool share_tr = share_trs && tex_set.faces.empty();
+        auto       images   = next_images.valid() ? next_images.get() : readSetImages(key, tex_set, args.io_threads, args.mmap, profiler, share_tr ? d3d.shared_tr_hash : 0);
+        if (next_key != nullptr) {
+            const auto& next_set    = tex_inputs.at(*next_key);
+            const auto  resident_tr = share_tr ? tex_set.tr.content_hash : 0;
+            next_images             = std::async(std::launch::async, [&args, &profiler, next_key, &next_set, resident_tr]() {
+                return readSetImages(*next_key, next_set, args.io_threads, args.mmap, profiler, resident_tr);
+            });
+        }
+
+        HRESULT hr = images.hr;
+        if (args.backend == Backend::kCpu) {
+            if (SUCCEEDED(hr))
+                hr = bakeSetCpu(args, profiler, save_pipeline, key, tex_set, images);
+            if (FAILED(hr)) {
+                spdlog::error("\t{}Failed to bake texture set \"{}\"", d3d.label, key);
+            } else {
+                baked.push_back(key);
+                spdlog::info("\t{}Done", d3d.label);
+            }
+            continue;
+        }
+        if (SUCCEEDED(hr) && share_tr) {
+            if (tex_set.tr.content_hash == d3d.shared_tr_hash)
+                tex_set.tr.srv = d3d.shared_tr;
+            else if (images.tr.image.pixels == nullptr) // skipped for the set before, which failed
+                hr = loadInputImage(tex_set.tr.path, args.mmap, images.tr);
+        }
+        if (SUCCEEDED(hr)) {
+            ScopedTimer timer(profiler, key, Stage::kUpload);
+            hr = uploadSet(d3d.device.get(), images, tex_set);
+        }
+        if (SUCCEEDED(hr) && share_tr) {
+            d3d.shared_tr_hash = tex_set.tr.content_hash;
+            d3d.shared_tr      = tex_set.tr.srv;
+        }
+        if (FAILED(hr)) {
+            spdlog::warn("\t{}Failed to upload texture set \"{}\". Skipping the whole set", d3d.label, key);
+            releaseSet(tex_set);
+            continue;
+        }
+
+        const auto width       = tex_set.tr.width;
+        const auto height      = tex_set.tr.height;
+        const auto face_count  = static_cast<uint32_t>(std::max<size_t>(1, tex_set.faces.size()));
+        const auto light_count = tex_set.colors.size() / face_count; // the same lights on every face
+        const auto bytes       = bakeJobBytes(args, tex_set);
+        if (!jobs.empty() && (jobs.size() >= max_jobs || jobs_bytes + bytes > jobs_budget))
+            flush_jobs();
+
+        jobs.push_back({
+            .key = key,
+            .cb_data{
+                .weight    = unitWeight(std::span(tex_set.colors).first(light_count)),
+                .face      = tex_set.face,
+                .faces     = packFaces(tex_set.faces),
+                .face_dims = {width, height},
+            },
+            .colors     = std::span(tex_set.colors).first(light_count),
+            .colors_srv = tex_set.colors_srv.get(),
+            .tr_srv     = tex_set.tr.srv.get(),
+            .cb         = d3d.job_buffers[jobs.size()].get(),
+            .width      = width,
+            .height     = height,
+            .face_count = face_count,
+            .pack_info  = packInfo(tex_set),
+        });
+        jobs_bytes += bytes;
+    }
+    flush_jobs();
+    resolveValidations(d3d);
+    d3d.shared_tr_hash = 0;
+    d3d.shared_tr      = nullptr;
+    d3d.view_dir_luts.clear(); // not kept across --serve jobs
+
+    const auto hr = save_pipeline.finish();
+    if (SUCCEEDED(hr))
+        baked_keys = std::move(baked);
+    if (args.backend == Backend::kGpu)
+        spdlog::info("{}Allocated {} output textures", d3d.label, d3d.tex_pool.allocations());
+    if (args.profile)
+        d3d.gpu_timer.collect(profiler, true);
+    return hr;
+}
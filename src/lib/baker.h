@@ -0,0 +1,373 @@
+#pragma once
+// The bake on d3d11, d3d12 or the cpu: devices, shaders, dispatches, validation & the per device loop over the sets.
+
+#include <deque>
+#include <unordered_map>
+
+#include <d3d12.h>
+#include <dxgi1_3.h>
+#include <dxgi1_4.h>
+
+#include "lib/loader.h"
+#include "lib/writer.h"
+
+// light directions of a set & how many colors each stands for, for the batched bake kernel
+struct BatchedInputs {
+    com_ptr<ID3D11Buffer>             light_dirs     = nullptr;
+    com_ptr<ID3D11ShaderResourceView> light_dirs_srv = nullptr;
+};
+
+struct BakeCBData {
+    DirectX::XMFLOAT3 light_dir;
+    float             weight;
+    uint32_t          face;
+    uint32_t          light_count; // batched only
+    uint32_t          slice;       // per-direction only
+    uint32_t          faces;       // --group-faces only, face of each slice in 4 bits
+    DirectX::XMUINT2  tile_offset; // tiled only, texel offset of the bound textures within the face
+    DirectX::XMUINT2  face_dims;
+    float             prev_scale; // batched only, scales what the coefficients hold before the lights are added, 0 overwrites it
+    float             _pad[3];
+};
+static_assert(sizeof(BakeCBData) % 16 == 0);
+
+// a texture set being baked, each has its own textures & constant data so several can be interleaved, see --concurrent-sets
+struct BakeJob {
+    std::string                   key;
+    BakeCBData                    cb_data    = {};
+    std::span<const InputTexture> colors     = {};
+    ID3D11ShaderResourceView*     colors_srv = nullptr;
+    ID3D11ShaderResourceView*     tr_srv     = nullptr;
+    ID3D11Buffer*                 cb         = nullptr;
+    uint32_t                      width      = 0;
+    uint32_t                      height     = 0;
+    uint32_t                      face_count = 1; // sh_coeffs has shSlices per face, see --group-faces
+    PackInfo                      pack_info  = {};
+
+    ShTexture     sh_coeffs      = {};
+    ShTexture     bc6h           = {}; // gpu compressor output
+    BatchedInputs batched_inputs = {};
+};
+
+// errors of one light direction in a set, mirrors the float4 of ValidationReduce.cs.hlsl
+struct ValidationStats {
+    float sum_sq_error = 0; // reconstruction against the input radiance
+    float max_error    = 0;
+    float sum_sq_input = 0;
+    float _pad         = 0;
+};
+static_assert(sizeof(ValidationStats) == 16);
+
+// stats copied to a staging buffer, mapped with the next batch so the gpu is not waited on
+struct PendingValidation {
+    std::string                   key;
+    std::span<const InputTexture> colors;
+    uint64_t                      texels  = 0;
+    com_ptr<ID3D11Buffer>         staging = nullptr;
+};
+
+// timestamp queries around ranges of gpu work, only read back once the gpu is past them
+class GpuTimer {
+public:
+    // a range shared by several sets gets split between them by weight
+    using Shares = std::vector<std::pair<std::string, double>>;
+
+    // disabled until then
+    void init(ID3D11Device* device_, ID3D11DeviceContext* context_)
+    {
+        device  = device_;
+        context = context_;
+    }
+
+    void beginFrame()
+    {
+        if (device == nullptr)
+            return;
+        auto& frame    = frames.emplace_back();
+        frame.disjoint = makeQuery(free_disjoint_queries, D3D11_QUERY_TIMESTAMP_DISJOINT);
+        context->Begin(frame.disjoint.get());
+    }
+
+    void endFrame()
+    {
+        if (device == nullptr)
+            return;
+        context->End(frames.back().disjoint.get());
+    }
+
+    void begin()
+    {
+        if (device == nullptr)
+            return;
+        auto& range = frames.back().ranges.emplace_back();
+        range.begin = makeQuery(free_timestamp_queries, D3D11_QUERY_TIMESTAMP);
+        context->End(range.begin.get());
+    }
+
+    void end(Stage stage, Shares shares)
+    {
+        if (device == nullptr)
+            return;
+        auto& range  = frames.back().ranges.back();
+        range.end    = makeQuery(free_timestamp_queries, D3D11_QUERY_TIMESTAMP);
+        range.stage  = stage;
+        range.shares = std::move(shares);
+        context->End(range.end.get());
+    }
+
+    // hands finished frames to the profiler, without wait this stops at the first one the gpu is not done with
+    void collect(Profiler& profiler, bool wait)
+    {
+        const auto poll = [this, wait](ID3D11Query* query, void* data, UINT size) {
+            HRESULT hr = S_FALSE;
+            while ((hr = context->GetData(query, data, size, wait ? 0 : D3D11_ASYNC_GETDATA_DONOTFLUSH)) == S_FALSE && wait)
+                std::this_thread::yield();
+            return hr;
+        };
+
+        while (!frames.empty()) {
+            auto& frame = frames.front();
+
+            D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjoint = {};
+            const auto                          hr       = poll(frame.disjoint.get(), &disjoint, sizeof(disjoint));
+            if (hr == S_FALSE)
+                return;
+
+            // a disjoint frame has unreliable timestamps, drop it
+            if (hr == S_OK && !disjoint.Disjoint) {
+                for (auto const& range : frame.ranges) {
+                    UINT64 begin_ticks = 0;
+                    UINT64 end_ticks   = 0;
+                    if (poll(range.begin.get(), &begin_ticks, sizeof(begin_ticks)) != S_OK || poll(range.end.get(), &end_ticks, sizeof(end_ticks)) != S_OK)
+                        continue;
+
+                    const double ms           = static_cast<double>(end_ticks - begin_ticks) * 1000.0 / static_cast<double>(disjoint.Frequency);
+                    double       total_weight = 0;
+                    for (auto const& [set, weight] : range.shares)
+                        total_weight += weight;
+                    for (auto const& [set, weight] : range.shares)
+                        profiler.add(set, range.stage, ms * weight / total_weight);
+                }
+            }
+
+            for (auto& range : frame.ranges) {
+                free_timestamp_queries.push_back(std::move(range.begin));
+                free_timestamp_queries.push_back(std::move(range.end));
+            }
+            free_disjoint_queries.push_back(std::move(frame.disjoint));
+            frames.pop_front();
+        }
+    }
+
+private:
+    struct Range {
+        com_ptr<ID3D11Query> begin = nullptr;
+        com_ptr<ID3D11Query> end   = nullptr;
+        Stage                stage = Stage::kBake;
+        Shares               shares;
+    };
+
+    struct Frame {
+        com_ptr<ID3D11Query> disjoint = nullptr;
+        std::vector<Range>   ranges;
+    };
+
+    com_ptr<ID3D11Query> makeQuery(std::vector<com_ptr<ID3D11Query>>& free_list, D3D11_QUERY type)
+    {
+        if (!free_list.empty()) {
+            auto retval = std::move(free_list.back());
+            free_list.pop_back();
+            return retval;
+        }
+        D3D11_QUERY_DESC     desc   = {.Query = type, .MiscFlags = 0};
+        com_ptr<ID3D11Query> retval = nullptr;
+        DX::ThrowIfFailed(device->CreateQuery(&desc, retval.put()));
+        return retval;
+    }
+
+    ID3D11Device*        device  = nullptr;
+    ID3D11DeviceContext* context = nullptr;
+
+    std::deque<Frame>                 frames;
+    std::vector<com_ptr<ID3D11Query>> free_timestamp_queries;
+    std::vector<com_ptr<ID3D11Query>> free_disjoint_queries;
+};
+
+// --backend d3d12, see bakeOnD3d12
+struct D3d12Objs {
+    com_ptr<ID3D12Device>         device          = nullptr;
+    com_ptr<ID3D12CommandQueue>   compute_queue   = nullptr;
+    com_ptr<ID3D12CommandQueue>   copy_queue      = nullptr;
+    com_ptr<ID3D12Fence>          baked_fence     = nullptr; // signaled by the compute queue, waited on by the copy queue
+    com_ptr<ID3D12Fence>          copied_fence    = nullptr; // signaled by the copy queue, waited on before mapping
+    uint64_t                      fence_value     = 0;       // last value of both fences, one per set
+    com_ptr<ID3D12RootSignature>  root_signature  = nullptr;
+    com_ptr<ID3D12PipelineState>  bake_pso        = nullptr;
+    uint32_t                      bake_group_size = 8; // threads per side of bake_pso's groups
+    com_ptr<ID3D12PipelineState>  validation_pso  = nullptr;
+    com_ptr<ID3D12DescriptorHeap> heap            = nullptr; // shader visible, DESCRIPTORS_PER_FRAME per frame
+    com_ptr<ID3D12DescriptorHeap> clear_heap      = nullptr; // cpu only copy of each frame's sh uav, for clears
+    UINT                          descriptor_size = 0;
+};
+
+struct D3dObjs {
+    com_ptr<ID3D11Device1>        device  = nullptr;
+    com_ptr<ID3D11DeviceContext1> context = nullptr;
+    D3d12Objs                     d3d12; // --backend d3d12 only, device & context stay null
+
+    std::string                                  label; // log prefix, empty with a single device
+    ShTexturePool                                tex_pool;
+    ReadbackPools                                readback_pools; // also kept across --serve jobs
+    uint64_t                                     shared_tr_hash = 0; // --dedup, content of shared_tr
+    com_ptr<ID3D11ShaderResourceView>            shared_tr      = nullptr; // the tr of the last set uploaded, reused by the next of the same content
+    com_ptr<ID3D11Buffer>                        common_buffer = nullptr;
+    std::vector<com_ptr<ID3D11Buffer>>           job_buffers;   // constant buffers of concurrent sets, common_buffer is the first
+    GpuTimer                                     gpu_timer;
+    uint64_t                                     shader_hash = 0; // of all bytecode in use, see --incremental
+    com_ptr<ID3D11ComputeShader>                 bake_cs         = nullptr;
+    com_ptr<ID3D11ComputeShader>                 bake_batched_cs = nullptr;
+    com_ptr<ID3D11ComputeShader>                 validation_cs   = nullptr;
+    com_ptr<ID3D11ComputeShader>                 bc6h_cs         = nullptr;
+
+    // --validate, partials & stats are reused by every set as their dispatches run in order
+    // the stats are copied into staging buffers of validation_stats_count lights, which come back once resolved
+    com_ptr<ID3D11ComputeShader>       validation_all_cs         = nullptr;
+    com_ptr<ID3D11ComputeShader>       validation_reduce_cs      = nullptr;
+    com_ptr<ID3D11Buffer>              validation_partials       = nullptr;
+    com_ptr<ID3D11ShaderResourceView>  validation_partials_srv   = nullptr;
+    com_ptr<ID3D11UnorderedAccessView> validation_partials_uav   = nullptr;
+    uint32_t                           validation_partials_count = 0;
+    com_ptr<ID3D11Buffer>              validation_stats          = nullptr;
+    com_ptr<ID3D11UnorderedAccessView> validation_stats_uav      = nullptr;
+    uint32_t                           validation_stats_count    = 0; // most lights of a set so far
+    std::vector<com_ptr<ID3D11Buffer>> validation_staging;            // free ones
+    std::vector<PendingValidation>     pending_validations;
+
+    // --phase-lut, view directions of the regions dispatched lately, by face, face size, offset & size, see viewDirLut
+    com_ptr<ID3D11ShaderResourceView>                                     phase_lut_srv = nullptr;
+    std::map<std::array<uint32_t, 7>, com_ptr<ID3D11ShaderResourceView>> view_dir_luts;
+};
+
+template <bool is_sh>
+constexpr DXGI_FORMAT texFormat()
+{
+    return is_sh ? DXGI_FORMAT_R32G32B32A32_FLOAT : DXGI_FORMAT_R32_FLOAT;
+}
+
+// coefficients of one face, see --sh-order
+constexpr uint32_t shCoeffs(uint32_t sh_order)
+{
+    return (sh_order + 1) * (sh_order + 1);
+}
+
+// sh slices of one face, 3 coefficients each with the last one zero padded, like Bake.cs.hlsl
+constexpr uint32_t shSlices(uint32_t sh_order)
+{
+    return (shCoeffs(sh_order) + 2) / 3;
+}
+
+// format only matters for sh, half precision needs the batched kernel as it never reads back while accumulating
+// sh_slices too, shSlices per face, 3 for a single L2 face
+template <bool is_sh>
+ShTexture initTex(ID3D11Device* device, uint32_t width, uint32_t height, DXGI_FORMAT format = texFormat<is_sh>(), uint32_t sh_slices = 3)
+{
+    ShTexture retval;
+
+    D3D11_TEXTURE2D_DESC tex_desc = {
+        .Width          = width,
+        .Height         = height,
+        .MipLevels      = 1,
+        .ArraySize      = is_sh ? sh_slices : 1,
+        .Format         = format,
+        .SampleDesc     = {.Count = 1, .Quality = 0},
+        .Usage          = D3D11_USAGE_DEFAULT,
+        .BindFlags      = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS,
+        .CPUAccessFlags = 0,
+        .MiscFlags      = 0,
+    };
+
+    D3D11_SHADER_RESOURCE_VIEW_DESC srv_desc = {
+        .Format        = tex_desc.Format,
+        .ViewDimension = is_sh ? D3D11_SRV_DIMENSION_TEXTURE2DARRAY : D3D11_SRV_DIMENSION_TEXTURE2D,
+    };
+    if constexpr (is_sh)
+        srv_desc.Texture2DArray = {.MostDetailedMip = 0, .MipLevels = 1, .FirstArraySlice = 0, .ArraySize = tex_desc.ArraySize};
+    else
+        srv_desc.Texture2D = {.MostDetailedMip = 0, .MipLevels = 1};
+
+    D3D11_UNORDERED_ACCESS_VIEW_DESC uav_desc = {
+        .Format        = tex_desc.Format,
+        .ViewDimension = is_sh ? D3D11_UAV_DIMENSION_TEXTURE2DARRAY : D3D11_UAV_DIMENSION_TEXTURE2D,
+        .Texture2D     = {.MipSlice = 0},
+    };
+    if constexpr (is_sh)
+        uav_desc.Texture2DArray = {.MipSlice = 0, .FirstArraySlice = 0, .ArraySize = tex_desc.ArraySize};
+    else
+        uav_desc.Texture2D = {.MipSlice = 0};
+
+    DX::ThrowIfFailed(device->CreateTexture2D(&tex_desc, nullptr, retval.tex.put()));
+    DX::ThrowIfFailed(device->CreateShaderResourceView(retval.tex.get(), &srv_desc, retval.srv.put()));
+    DX::ThrowIfFailed(device->CreateUnorderedAccessView(retval.tex.get(), &uav_desc, retval.uav.put()));
+
+    return retval;
+}
+
+template <bool is_sh>
+ShTexture acquireTex(D3dObjs& d3d, uint32_t width, uint32_t height, DXGI_FORMAT format = texFormat<is_sh>(), uint32_t sh_slices = 3)
+{
+    return d3d.tex_pool.acquire(width, height, is_sh ? sh_slices : 1, format, [&]() { return initTex<is_sh>(d3d.device.get(), width, height, format, sh_slices); });
+}
+
+ShTexture acquireBC6HBlockTex(D3dObjs& d3d, uint32_t width, uint32_t height, uint32_t sh_slices = 3);
+
+// runs the bake kernel over a face, or a tile of it with cb_data.tile_offset, cb_data.face/face_dims are set by the caller
+// as is cb_data.weight, that of one color, see unitWeight(), each light's is scaled by its count
+// jobs are interleaved light by light, so dispatches writing to different textures are back to back
+void dispatchBake(D3dObjs& d3d, bool batched, std::span<BakeJob> jobs);
+
+// reconstructs the job's last light from its baked coefficients
+// with --phase-lut, lut_error_uav gets the relative error of the tabulated phase, writes are dropped if it is null
+void dispatchValidation(D3dObjs& d3d, const BakeJob& job, ID3D11UnorderedAccessView* out_uav, ID3D11UnorderedAccessView* lut_error_uav = nullptr);
+
+// every light of the job against its input radiance, reduced to ValidationStats per light on the gpu, see --validate
+// the stats are copied to a staging buffer in d3d.pending_validations, the bake loop reads them back with the next batch
+void dispatchValidationStats(D3dObjs& d3d, BakeJob& job);
+
+void dispatchBC6H(D3dObjs& d3d, ID3D11ShaderResourceView* sh_srv, ID3D11UnorderedAccessView* blocks_uav, uint32_t width, uint32_t height, uint32_t sh_slices = 3);
+
+// a read back of tex that waits for the gpu, through the device's pools, image goes back to d3d.readback_pools.images once used
+HRESULT readbackTex(D3dObjs& d3d, ID3D11Texture2D* tex, DirectX::ScratchImage& image);
+
+// gpus is "all" or comma separated indices into enumerateAdapters(), see --gpus
+HRESULT selectAdapters(const std::string& gpus, std::vector<com_ptr<IDXGIAdapter1>>& selected);
+
+// adapter = nullptr picks the default one
+HRESULT initDevice(D3dObjs& d3d, IDXGIAdapter* adapter = nullptr);
+
+// constant buffer, shaders & the state every dispatch shares
+HRESULT initShaders(D3dObjs& d3d, const Arguments& args);
+
+// sets left to bake, shared by all devices, each takes the next one whenever it is ready for more
+class SetQueue {
+public:
+    explicit SetQueue(std::span<const std::string> keys) : keys(keys) {}
+
+    // nullptr once empty, safe to call from any thread
+    const std::string* pop()
+    {
+        const auto idx = next_idx++;
+        return (idx < keys.size()) ? &keys[idx] : nullptr;
+    }
+
+private:
+    std::span<const std::string> keys;
+    std::atomic_size_t           next_idx = 0;
+};
+
+// device, queues, fences, the shared root signature & pipelines, the bytecode gets folded into d3d.shader_hash
+HRESULT initDevice12(D3dObjs& d3d, const Arguments& args, IDXGIAdapter* adapter = nullptr);
+
+// bakes sets from the queue until it runs dry, on its own thread & with its own save pipeline, see --gpus
+// each set of tex_inputs is only touched by the device that took it, baked_keys gets the sets whose outputs were saved
+// pack is shared by all devices, null without --pack
+HRESULT bakeOnDevice(D3dObjs& d3d, const Arguments& args, Profiler& profiler, std::unordered_map<std::string, InputTexSet>& tex_inputs, SetQueue& queue, std::vector<std::string>& baked_keys, PackWriter* pack);
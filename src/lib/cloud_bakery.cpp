@@ -0,0 +1,243 @@
+// The library API of lib/cloud_bakery.h over the bake internals of lib/baker.h.
+#include "lib/cloud_bakery.h"
+
+#include "lib/baker.h"
+
+namespace {
+// the color slices are each one light's radiance, so single channel, the tr only has its red channel sampled
+bool singleChannelFloat(DXGI_FORMAT format)
+{
+    switch (format) {
+    case DXGI_FORMAT_R32_FLOAT:
+    case DXGI_FORMAT_R16_FLOAT:
+    case DXGI_FORMAT_R16_UNORM:
+    case DXGI_FORMAT_R16_SNORM:
+    case DXGI_FORMAT_R8_UNORM:
+    case DXGI_FORMAT_R8_SNORM:
+    case DXGI_FORMAT_BC4_UNORM:
+    case DXGI_FORMAT_BC4_SNORM:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool readableAsFloat(DXGI_FORMAT format)
+{
+    const auto type = DirectX::FormatDataType(format);
+    return type == DirectX::FORMAT_TYPE_FLOAT || type == DirectX::FORMAT_TYPE_UNORM || type == DirectX::FORMAT_TYPE_SNORM;
+}
+
+// a caller's srv of width x height texels, a Texture2D with slices = 0 & a single channel Texture2DArray of at least that many slices otherwise
+bool validInputSrv(ID3D11ShaderResourceView* srv, uint32_t width, uint32_t height, uint32_t slices)
+{
+    D3D11_SHADER_RESOURCE_VIEW_DESC srv_desc;
+    srv->GetDesc(&srv_desc);
+
+    UINT mip = 0;
+    if (slices == 0) {
+        if (srv_desc.ViewDimension != D3D11_SRV_DIMENSION_TEXTURE2D || !readableAsFloat(srv_desc.Format))
+            return false;
+        mip = srv_desc.Texture2D.MostDetailedMip;
+    } else {
+        if (srv_desc.ViewDimension != D3D11_SRV_DIMENSION_TEXTURE2DARRAY || srv_desc.Texture2DArray.ArraySize < slices || !singleChannelFloat(srv_desc.Format))
+            return false;
+        mip = srv_desc.Texture2DArray.MostDetailedMip;
+    }
+
+    com_ptr<ID3D11Resource> resource = nullptr;
+    srv->GetResource(resource.put());
+    const auto tex = resource.try_as<ID3D11Texture2D>();
+    if (tex == nullptr)
+        return false;
+    D3D11_TEXTURE2D_DESC tex_desc;
+    tex->GetDesc(&tex_desc);
+    return std::max(tex_desc.Width >> mip, 1U) == width && std::max(tex_desc.Height >> mip, 1U) == height;
+}
+} // namespace
+
+namespace cloud_bakery {
+struct Baker::Impl {
+    Arguments args;
+    D3dObjs   d3d;
+    Profiler  profiler; // the internals time into one, nothing reads it
+};
+
+Baker::Baker(std::unique_ptr<Impl> impl) :
+    impl(std::move(impl)) {}
+
+Baker::~Baker() = default;
+
+HRESULT Baker::create(ID3D11Device* device, const Settings& settings, std::unique_ptr<Baker>& baker)
+{
+    if (device == nullptr || (settings.sh_order != 1 && settings.sh_order != 2) || (settings.half_coeffs && !settings.batched))
+        return E_INVALIDARG;
+
+    auto impl = std::make_unique<Impl>();
+
+    auto& args      = impl->args;
+    args.batched    = settings.batched;
+    args.sh_order   = settings.sh_order;
+    args.sh_format  = settings.half_coeffs ? DXGI_FORMAT_R16G16B16A16_FLOAT : DXGI_FORMAT_R32G32B32A32_FLOAT;
+    args.phase_lut  = settings.phase_lut;
+    args.shader_dir = settings.shader_dir;
+
+    // the same 1.1 interfaces initDevice gets of its own device
+    auto& d3d = impl->d3d;
+    {
+        com_ptr<ID3D11Device> base_device;
+        base_device.copy_from(device);
+        d3d.device = base_device.try_as<ID3D11Device1>();
+
+        com_ptr<ID3D11DeviceContext> base_device_ctxt;
+        device->GetImmediateContext(base_device_ctxt.put());
+        d3d.context = base_device_ctxt.try_as<ID3D11DeviceContext1>();
+    }
+    if (d3d.device == nullptr || d3d.context == nullptr) {
+        spdlog::error("Failed to get ID3D11Device1 & ID3D11DeviceContext1");
+        return E_NOINTERFACE;
+    }
+
+    HRESULT hr = initShaders(d3d, args);
+    if (FAILED(hr))
+        return hr;
+
+    baker.reset(new Baker(std::move(impl)));
+    return S_OK;
+}
+
+HRESULT Baker::bake(const FaceInput& input, ShOutput& output)
+{
+    auto&       d3d         = impl->d3d;
+    const auto& args        = impl->args;
+    const auto  width       = input.width;
+    const auto  height      = input.height;
+    const auto  light_count = static_cast<uint32_t>(input.light_directions.size());
+    if (width == 0 || height == 0 || input.face > 4 || light_count == 0 || light_count > D3D11_REQ_TEXTURE2D_ARRAY_AXIS_DIMENSION)
+        return E_INVALIDARG;
+
+    InputTexSet tex_set{.face = input.face};
+    for (auto const& dir : input.light_directions) {
+        tex_set.colors.push_back({
+            .light_direction = {dir[0], dir[1], dir[2]},
+            .width           = width,
+            .height          = height,
+        });
+    }
+
+    // Upload what the caller has no textures of, they are released with tex_set, the gpu keeps them alive until the bake is done
+    const size_t texels = static_cast<size_t>(width) * height;
+
+    // wrapped, the pixels are only read
+    const auto image = [&](const float* texels_begin) {
+        return DirectX::Image{
+            .width      = width,
+            .height     = height,
+            .format     = DXGI_FORMAT_R32_FLOAT,
+            .rowPitch   = width * sizeof(float),
+            .slicePitch = texels * sizeof(float),
+            .pixels     = reinterpret_cast<uint8_t*>(const_cast<float*>(texels_begin)),
+        };
+    };
+    const DirectX::TexMetadata metadata = {
+        .width     = width,
+        .height    = height,
+        .depth     = 1,
+        .arraySize = 1,
+        .mipLevels = 1,
+        .format    = DXGI_FORMAT_R32_FLOAT,
+        .dimension = DirectX::TEX_DIMENSION_TEXTURE2D,
+    };
+
+    auto* tr_srv = input.tr_srv;
+    if (tr_srv != nullptr) {
+        if (!validInputSrv(tr_srv, width, height, 0)) {
+            spdlog::error("tr_srv is not a {} x {} Texture2D read as float", width, height);
+            return E_INVALIDARG;
+        }
+    } else {
+        if (input.tr_texels.size() != texels)
+            return E_INVALIDARG;
+
+        const auto tr_image = image(input.tr_texels.data());
+        HRESULT    hr       = DirectX::CreateShaderResourceView(d3d.device.get(), &tr_image, 1, metadata, tex_set.tr.srv.put());
+        if (FAILED(hr)) {
+            spdlog::error("Failed to upload the transmittance");
+            return hr;
+        }
+        tr_srv = tex_set.tr.srv.get();
+    }
+
+    auto* colors_srv = input.colors_srv;
+    if (colors_srv != nullptr) {
+        if (!validInputSrv(colors_srv, width, height, light_count)) {
+            spdlog::error("colors_srv is not a {} x {} Texture2DArray of {} single channel slices read as float", width, height, light_count);
+            return E_INVALIDARG;
+        }
+    } else {
+        if (input.color_texels.size() != texels * light_count)
+            return E_INVALIDARG;
+
+        std::vector<DirectX::Image> color_images;
+        for (uint32_t i = 0; i < light_count; ++i)
+            color_images.push_back(image(input.color_texels.data() + (i * texels)));
+        HRESULT hr = initColorArray(d3d.device.get(), color_images, tex_set.colors_tex, tex_set.colors_srv);
+        if (FAILED(hr)) {
+            spdlog::error("Failed to upload the colors");
+            return hr;
+        }
+        colors_srv = tex_set.colors_srv.get();
+    }
+
+    // Dispatch
+    BakeJob job{
+        .key = "in-process",
+        .cb_data{
+            .weight    = unitWeight(tex_set.colors),
+            .face      = input.face,
+            .face_dims = {width, height},
+        },
+        .colors     = tex_set.colors,
+        .colors_srv = colors_srv,
+        .tr_srv     = tr_srv,
+        .cb         = d3d.common_buffer.get(),
+        .width      = width,
+        .height     = height,
+    };
+    job.sh_coeffs   = acquireTex<true>(d3d, width, height, args.sh_format, shSlices(args.sh_order));
+    float values[4] = {0, 0, 0, 0};
+    d3d.context->ClearUnorderedAccessViewFloat(job.sh_coeffs.uav.get(), values);
+    dispatchBake(d3d, args.batched, {&job, 1});
+
+    output = {
+        .tex = std::move(job.sh_coeffs.tex),
+        .srv = std::move(job.sh_coeffs.srv),
+        .uav = std::move(job.sh_coeffs.uav),
+    };
+    return S_OK;
+}
+
+void Baker::release(ShOutput&& output)
+{
+    impl->d3d.tex_pool.release({
+        .tex = std::move(output.tex),
+        .srv = std::move(output.srv),
+        .uav = std::move(output.uav),
+    });
+    output = {};
+}
+
+HRESULT Baker::save(const ShOutput& output, const std::filesystem::path& path, bool compressed)
+{
+    auto&                 d3d = impl->d3d;
+    DirectX::ScratchImage image;
+    HRESULT               hr = readbackTex(d3d, output.tex.get(), image);
+    if (FAILED(hr)) {
+        spdlog::error("Failed to read back {}", path.string());
+        return hr;
+    }
+    hr = saveImageToDDS(image, path, compressed, impl->profiler, path.stem().string());
+    d3d.readback_pools.images.release(std::move(image));
+    return hr;
+}
+} // namespace cloud_bakery
@@ -0,0 +1,72 @@
+#pragma once
+// Bakes SH coefficients in-process on the caller's d3d11 device, from its textures or cpu buffers, without touching the disk.
+// Built as the cloud-bakery-lib static library, see xmake.lua & lib/cloud_bakery.cpp.
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <span>
+
+#include <d3d11.h>
+#include <winrt/base.h>
+
+namespace cloud_bakery {
+// the matching options of the executable, fixed when a Baker is created as they pick its shaders
+struct Settings {
+    bool                  batched     = true;  // all light directions in one dispatch, see --batched
+    uint32_t              sh_order    = 2;     // 1 or 2, see --sh-order
+    bool                  half_coeffs = false; // R16G16B16A16_FLOAT coefficients, requires batched, see --sh-format
+    bool                  phase_lut   = false; // see --phase-lut
+    std::filesystem::path shader_dir;          // empty = embedded bytecode, see --shader-dir
+};
+
+// one face of a texture set, what the executable reads from "(identifier)_(face)_tr.dds" & "(identifier)_(face)_(x)_(y)_(z).dds"
+// each input is read from its srv when set & uploaded from its cpu buffer otherwise, srvs not matching width, height & the light count fail with E_INVALIDARG
+struct FaceInput {
+    uint32_t                              face   = 0; // +x, -x, +y, -y, +z
+    uint32_t                              width  = 0;
+    uint32_t                              height = 0;
+    std::span<const std::array<float, 3>> light_directions; // of each color slice
+
+    ID3D11ShaderResourceView* tr_srv     = nullptr; // Texture2D of a float, unorm or snorm format, the red channel is sampled
+    ID3D11ShaderResourceView* colors_srv = nullptr; // Texture2DArray of a single channel float, unorm or snorm format, slice i lit from light_directions[i]
+
+    std::span<const float> tr_texels;    // width * height, rows top to bottom
+    std::span<const float> color_texels; // width * height of each light, one after the other
+};
+
+// sh slices of RGBA like the "_sh.dds" outputs, 3 for order 2 & 2 for order 1
+struct ShOutput {
+    winrt::com_ptr<ID3D11Texture2D>           tex = nullptr;
+    winrt::com_ptr<ID3D11ShaderResourceView>  srv = nullptr; // Texture2DArray
+    winrt::com_ptr<ID3D11UnorderedAccessView> uav = nullptr; // written by the bake
+};
+
+class Baker {
+public:
+    // loads the shaders on device, bakes are recorded on its immediate context
+    static HRESULT create(ID3D11Device* device, const Settings& settings, std::unique_ptr<Baker>& baker);
+
+    Baker(const Baker&)            = delete;
+    Baker& operator=(const Baker&) = delete;
+    ~Baker();
+
+    // queues the bake of input into output, later work on the immediate context sees the coefficients
+    // leaves the bake shader & its constant buffer bound to the compute stage
+    HRESULT bake(const FaceInput& input, ShOutput& output);
+
+    // hands output back, later bakes of the same size reuse its texture
+    void release(ShOutput&& output);
+
+    // reads output back & writes it like the executable, compressed to BC6H or as is
+    HRESULT save(const ShOutput& output, const std::filesystem::path& path, bool compressed);
+
+private:
+    struct Impl;
+
+    explicit Baker(std::unique_ptr<Impl> impl);
+
+    std::unique_ptr<Impl> impl;
+};
+} // namespace cloud_bakery
@@ -0,0 +1,49 @@
+#include "lib/common.h"
+
+using namespace std::literals;
+
+float unitWeight(std::span<const InputTexture> colors)
+{
+    uint32_t total = 0;
+    for (auto const& color : colors)
+        total += color.count;
+    return 1.F / static_cast<float>(total);
+}
+
+uint32_t faceStrToUint(const std::string& str)
+{
+    static const std::map<std::string, uint32_t> KEYMAP = {
+        {"+x"s, 0},
+        {"-x"s, 1},
+        {"+y"s, 2},
+        {"-y"s, 3},
+        {"+z"s, 4},
+    };
+    return KEYMAP.at(str);
+}
+
+uint64_t hashBytes(std::string_view bytes, uint64_t hash)
+{
+    for (const char c : bytes) {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+std::string readFile(const std::filesystem::path& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    return {std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+}
+
+uint64_t hashFile(const std::filesystem::path& path, uint64_t hash)
+{
+    std::ifstream     file(path, std::ios::binary);
+    std::vector<char> chunk(1 << 20);
+    while (file) {
+        file.read(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+        hash = hashBytes({chunk.data(), static_cast<size_t>(file.gcount())}, hash);
+    }
+    return hash;
+}
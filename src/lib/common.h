@@ -0,0 +1,419 @@
+#pragma once
+// Types & helpers shared by the loader, baker & writer of cloud-bakery-lib, and by the executables built on it.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include <d3d11.h>
+#include <d3d11_1.h>
+#include <DirectXTex.h>
+#include <DirectXMath.h>
+#include <winrt/base.h>
+
+using winrt::com_ptr;
+
+// took from https://github.com/Microsoft/DirectXTK/wiki/throwIfFailed
+namespace DX {
+// Helper class for COM exceptions
+class com_exception : public std::exception {
+public:
+    com_exception(HRESULT hr) :
+        result(hr) {}
+
+    const char* what() const noexcept override
+    {
+        static char s_str[64] = {};
+        sprintf_s(s_str, "Failure with HRESULT of %08X",
+                  static_cast<unsigned int>(result));
+        return s_str;
+    }
+
+    HRESULT get_result() const { return result; }
+
+private:
+    HRESULT result;
+};
+
+// Helper utility converts D3D API failures into exceptions.
+inline void ThrowIfFailed(HRESULT hr)
+{
+    if (FAILED(hr)) {
+        throw com_exception(hr);
+    }
+}
+} // namespace DX
+
+// -----------------------------------------------------------------------------------------------------------------
+
+enum class Backend : uint8_t {
+    kGpu,
+    kCpu,   // multithreaded port of the bake kernel, for machines without a d3d11 device
+    kD3d12, // the same kernels on a compute queue, read back on a copy queue
+};
+
+enum class Incremental : uint8_t {
+    kOff,
+    kMtime,   // inputs are unchanged if name, size & mtime are
+    kContent, // hashes the whole files
+};
+
+struct Arguments {
+    std::filesystem::path in_dir;
+    std::filesystem::path out_dir;
+    std::filesystem::path validation_dir;
+    bool                  validate   = false; // errors of every light, see --validate
+    bool                  batched    = false;
+    uint32_t              io_threads = 1;
+    bool                  mmap       = false; // map inputs instead of reading them, see --mmap
+
+    uint32_t staging_count      = 3;
+    uint32_t writer_threads     = 2;
+    uint32_t max_pending_writes = 4;
+
+    bool        gpu_compressor = false;
+    DXGI_FORMAT sh_format      = DXGI_FORMAT_R32G32B32A32_FLOAT;
+    uint32_t    sh_order       = 2; // 1 or 2, see --sh-order
+
+    uint32_t tile_size = 0; // 0 = whole face at once
+
+    float tolerance = 0; // 0 = every light direction, see --tolerance
+
+    std::filesystem::path pack_path; // in out_dir, empty = one dds per set, see --pack
+
+    Backend  backend     = Backend::kGpu;
+    uint32_t cpu_threads = 1;
+
+    bool phase_lut = false; // gpu only
+
+    bool group_faces = false; // all faces of an identifier in one dispatch & output, see --group-faces
+
+    bool dedup = false; // inputs of the same content are baked & uploaded once, see --dedup
+
+    std::string gpus; // "all" or adapter indices like "0,2", empty = the default adapter
+
+    std::filesystem::path shader_dir; // empty = embedded bytecode
+
+    uint32_t concurrent_sets = 1; // 0 = as many as fit in free video memory
+
+    bool                  profile = false;
+    std::filesystem::path profile_out; // .json or .csv, empty = summary only
+
+    Incremental incremental = Incremental::kOff;
+
+    // empty = the default "(identifier)_(face)_tr.dds" & "(identifier)_(face)_(x)_(y)_(z).dds"
+    std::string tr_pattern;
+    std::string color_pattern;
+
+    std::string serve_pipe; // empty = bake in_dir once & exit, see --serve
+};
+
+struct ShTexture {
+    winrt::com_ptr<ID3D11Texture2D>    tex = nullptr;
+    com_ptr<ID3D11ShaderResourceView>  srv = nullptr;
+    com_ptr<ID3D11UnorderedAccessView> uav = nullptr;
+};
+
+struct InputTexture {
+    std::filesystem::path             path;
+    DirectX::XMFLOAT3                 light_direction = {1.F, 0.F, 0.F}; // note: unused for transmittance
+    uint32_t                          width           = 0;
+    uint32_t                          height          = 0;
+    DXGI_FORMAT                       format          = DXGI_FORMAT_UNKNOWN;
+    com_ptr<ID3D11ShaderResourceView> srv             = nullptr; // note: unused for colors, see InputTexSet::colors_srv
+    uint64_t                          content_hash    = 0;       // --dedup only, of the whole file
+    uint32_t                          count           = 1;       // colors of the set it stands for, more than one once --dedup collapsed them
+};
+
+// the weight of one color of a set, 1 / its light count, colors collapsed by --dedup count that many times
+float unitWeight(std::span<const InputTexture> colors);
+
+// a parsed input file, before any GPU resource is created
+struct LoadedFile {
+    std::string  filename;
+    std::string  key;
+    std::string  face_str;
+    bool         is_tr = false;
+    InputTexture tex;
+};
+
+struct InputTexSet {
+    uint32_t                  face;       // see Common.hlsli
+    std::string               identifier; // the key without its face, see identifierOf
+    InputTexture              tr;
+    std::vector<InputTexture> colors;
+
+    // --group-faces only, the faces of an identifier in slice order & their tr, colors then hold the colors of one face after the other
+    // face & tr are those of the first face
+    std::vector<uint32_t>     faces;
+    std::vector<InputTexture> face_trs;
+
+    // all colors packed into one array, slice i is colors[i]
+    // these & tr.srv only exist from just before the set is baked until its outputs are queued for saving
+    com_ptr<ID3D11Texture2D>          colors_tex = nullptr;
+    com_ptr<ID3D11ShaderResourceView> colors_srv = nullptr;
+};
+
+// what a --pack entry records of a set's sh output besides the texture, see PackWriter
+struct PackInfo {
+    uint32_t faces      = 0; // 4 bits per face in slice order, like BakeCBData::faces
+    uint32_t face_count = 0; // 0 = not a sh output, always saved as a file
+};
+
+// recycles textures by (width, height, array size, format), so same-sized sets allocate nothing after the first one
+class ShTexturePool {
+public:
+    // width, height, array_size & format are those of the texture make() would create
+    template <typename Factory>
+    ShTexture acquire(uint32_t width, uint32_t height, uint32_t array_size, DXGI_FORMAT format, Factory&& make)
+    {
+        auto& free_list = free_textures[{width, height, array_size, format}];
+        if (free_list.empty()) {
+            ++allocation_count;
+            return std::forward<Factory>(make)();
+        }
+        auto retval = std::move(free_list.back());
+        free_list.pop_back();
+        return retval;
+    }
+
+    void release(ShTexture&& tex)
+    {
+        if (tex.tex == nullptr)
+            return;
+        D3D11_TEXTURE2D_DESC desc;
+        tex.tex->GetDesc(&desc);
+        free_textures[{desc.Width, desc.Height, desc.ArraySize, desc.Format}].push_back(std::move(tex));
+        tex = {};
+    }
+
+    [[nodiscard]] size_t allocations() const { return allocation_count; }
+
+private:
+    struct Key {
+        uint32_t    width;
+        uint32_t    height;
+        uint32_t    array_size;
+        DXGI_FORMAT format;
+
+        auto operator<=>(const Key&) const = default;
+    };
+
+    std::map<Key, std::vector<ShTexture>> free_textures;
+    size_t                                allocation_count = 0;
+};
+
+// recycles read back images by (format, width, height, slices) once they are written, safe to use from any thread
+class ImagePool {
+public:
+    HRESULT acquire(DXGI_FORMAT format, size_t width, size_t height, size_t slices, DirectX::ScratchImage& image)
+    {
+        {
+            std::lock_guard lock(mutex);
+            auto&           free_list = free_images[{format, width, height, slices}];
+            if (!free_list.empty()) {
+                image = std::move(free_list.back());
+                free_list.pop_back();
+                return S_OK;
+            }
+        }
+        return image.Initialize2D(format, width, height, slices, 1);
+    }
+
+    void release(DirectX::ScratchImage&& image)
+    {
+        if (image.GetImageCount() == 0)
+            return;
+        const auto&     metadata = image.GetMetadata();
+        std::lock_guard lock(mutex);
+        free_images[{metadata.format, metadata.width, metadata.height, metadata.arraySize}].push_back(std::move(image));
+    }
+
+private:
+    using Key = std::tuple<DXGI_FORMAT, size_t, size_t, size_t>;
+
+    std::mutex                                        mutex;
+    std::map<Key, std::vector<DirectX::ScratchImage>> free_images;
+};
+
+// what read backs allocate, kept by a device for every SavePipeline & bakeTiled, so only the first set of a size allocates
+struct ReadbackPools {
+    ShTexturePool staging; // D3D11_USAGE_STAGING, device thread only
+    ImagePool     images;
+};
+
+enum class Stage : uint8_t {
+    kLoad,
+    kUpload,
+    kCompile,
+    kBake,       // gpu
+    kBC6H,       // gpu
+    kValidation, // gpu
+    kReadback,
+    kCompress,
+    kSave,
+    kCount,
+};
+
+constexpr std::array<const char*, static_cast<size_t>(Stage::kCount)> STAGE_NAMES = {
+    "load", "upload", "compile", "bake", "bc6h", "validation", "readback", "compress", "save"};
+
+// milliseconds per set & stage, thread safe, see --profile
+class Profiler {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static double msSince(Clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    // set is empty for work not belonging to a set, e.g. shader compilation
+    void add(std::string_view set, Stage stage, double ms)
+    {
+        std::lock_guard lock(mutex);
+        auto            it = timings.find(set);
+        if (it == timings.end())
+            it = timings.emplace(std::string{set}, Timings{}).first;
+        it->second[static_cast<size_t>(stage)] += ms;
+    }
+
+    void report() const
+    {
+        std::lock_guard lock(mutex);
+
+        std::string header = std::format("{:<32}", "set (ms)");
+        for (const auto* name : STAGE_NAMES)
+            header += std::format("{:>12}", name);
+        spdlog::info("{}", header);
+
+        Timings total = {};
+        Timings max   = {};
+        for (auto const& [set, timing] : timings) {
+            std::string line = std::format("{:<32}", set.empty() ? "(global)" : set);
+            for (size_t i = 0; i < timing.size(); ++i) {
+                line += std::format("{:>12.2f}", timing[i]);
+                total[i] += timing[i];
+                max[i] = std::max(max[i], timing[i]);
+            }
+            spdlog::info("{}", line);
+        }
+
+        const auto set_count = std::max<size_t>(1, std::ranges::count_if(timings, [](auto const& entry) { return !entry.first.empty(); }));
+        for (auto const& [label, row, scale] : {std::tuple{"total", &total, 1.0}, {"mean per set", &total, 1.0 / static_cast<double>(set_count)}, {"max per set", &max, 1.0}}) {
+            std::string line = std::format("{:<32}", label);
+            for (const double ms : *row)
+                line += std::format("{:>12.2f}", ms * scale);
+            spdlog::info("{}", line);
+        }
+    }
+
+    // format follows the extension, .csv or anything else for json
+    HRESULT dump(const std::filesystem::path& path) const
+    {
+        std::lock_guard lock(mutex);
+
+        std::ofstream file(path);
+        if (path.extension() == ".csv") {
+            file << "set";
+            for (const auto* name : STAGE_NAMES)
+                file << ',' << name;
+            file << '\n';
+            for (auto const& [set, timing] : timings) {
+                file << (set.empty() ? "(global)" : set);
+                for (const double ms : timing)
+                    file << std::format(",{:.4f}", ms);
+                file << '\n';
+            }
+        } else {
+            file << "{\n  \"sets\": {";
+            bool first_set = true;
+            for (auto const& [set, timing] : timings) {
+                file << (first_set ? "\n" : ",\n") << "    \"" << jsonEscape(set.empty() ? "(global)" : set) << "\": {";
+                for (size_t i = 0; i < timing.size(); ++i)
+                    file << std::format("{}\"{}\": {:.4f}", (i == 0) ? "" : ", ", STAGE_NAMES[i], timing[i]);
+                file << "}";
+                first_set = false;
+            }
+            file << "\n  }\n}\n";
+        }
+
+        if (!file) {
+            spdlog::error("Failed to write timings to {}", path.string());
+            return E_FAIL;
+        }
+        return S_OK;
+    }
+
+private:
+    using Timings = std::array<double, static_cast<size_t>(Stage::kCount)>;
+
+    static std::string jsonEscape(std::string_view str)
+    {
+        std::string retval;
+        for (const char c : str) {
+            if (c == '"' || c == '\\')
+                retval += '\\';
+            retval += c;
+        }
+        return retval;
+    }
+
+    mutable std::mutex                          mutex;
+    std::map<std::string, Timings, std::less<>> timings;
+};
+
+class ScopedTimer {
+public:
+    ScopedTimer(Profiler& profiler, std::string_view set, Stage stage) :
+        profiler(profiler), set(set), stage(stage) {}
+    ScopedTimer(const ScopedTimer&)            = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+    ~ScopedTimer() { profiler.add(set, stage, Profiler::msSince(start)); }
+
+private:
+    Profiler&                   profiler;
+    std::string_view            set;
+    Stage                       stage;
+    Profiler::Clock::time_point start = Profiler::Clock::now();
+};
+
+uint32_t faceStrToUint(const std::string& str);
+
+// fnv-1a
+uint64_t hashBytes(std::string_view bytes, uint64_t hash = 0xcbf29ce484222325ULL);
+
+std::string readFile(const std::filesystem::path& path);
+
+// chunked, for inputs too large to read at once
+uint64_t hashFile(const std::filesystem::path& path, uint64_t hash = 0xcbf29ce484222325ULL);
+
+// runs fn(i) for every i < count on up to thread_count threads, each index once
+template <typename Fn>
+void parallelFor(size_t count, size_t thread_count, Fn&& fn)
+{
+    std::atomic_size_t        next_idx = 0;
+    std::vector<std::jthread> workers;
+
+    workers.reserve(std::min(count, thread_count));
+    for (size_t i = 0; i < std::min(count, thread_count); ++i)
+        workers.emplace_back([&]() {
+            for (size_t idx = next_idx++; idx < count; idx = next_idx++)
+                fn(idx);
+        });
+}
@@ -0,0 +1,576 @@
+#include "lib/loader.h"
+
+#include <charconv>
+#include <ranges>
+
+#include <DDSTextureLoader.h>
+
+namespace {
+// "[+-]?(\d*\.\d+|\d+\.\d*|\d+)", as in color_pattern
+bool parseDirectionComponent(std::string_view str, float& value)
+{
+    // from_chars takes a leading '-' but no '+', a single sign of either kind is allowed
+    if (str.starts_with('+')) {
+        str.remove_prefix(1);
+        if (str.starts_with('-'))
+            return false;
+    }
+    if (str.empty() || str.front() == '+' || str.find_first_not_of("-.0123456789") != std::string_view::npos)
+        return false;
+    const auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), value, std::chars_format::fixed);
+    return (ec == std::errc{}) && (ptr == str.data() + str.size());
+}
+} // namespace
+
+NameParser::NameParser(const std::string& tr_pattern, const std::string& color_pattern)
+{
+    if (tr_pattern.empty() && color_pattern.empty())
+        return;
+    tr_re    = std::make_unique<RE2>(tr_pattern.empty() ? DEFAULT_TR_PATTERN : tr_pattern);
+    color_re = std::make_unique<RE2>(color_pattern.empty() ? DEFAULT_COLOR_PATTERN : color_pattern);
+}
+
+std::optional<ParsedName> NameParser::parse(const std::string& filename) const
+{
+    return tr_re ? parseRE2(filename) : parseDefault(filename);
+}
+
+std::optional<ParsedName> NameParser::parseRE2(const std::string& filename) const
+{
+    ParsedName  retval;
+    std::string identifier;
+
+    retval.is_tr = RE2::FullMatch(filename, *tr_re, &identifier, &retval.face_str);
+    if (!retval.is_tr && !RE2::FullMatch(filename, *color_re, &identifier, &retval.face_str, &retval.light_direction.x, &retval.light_direction.y, &retval.light_direction.z))
+        return std::nullopt;
+    retval.key = std::format("{}_{}", identifier, retval.face_str);
+    return retval;
+}
+
+std::optional<ParsedName> NameParser::parseDefault(std::string_view name)
+{
+    // the pattern's "." is any character
+    if (name.size() < 4 || !name.ends_with("dds"))
+        return std::nullopt;
+    name.remove_suffix(4);
+
+    const auto pop_token = [&name]() -> std::optional<std::string_view> {
+        const auto pos = name.rfind('_');
+        if (pos == std::string_view::npos)
+            return std::nullopt;
+        auto token = name.substr(pos + 1);
+        name       = name.substr(0, pos);
+        return token;
+    };
+
+    ParsedName retval;
+    if (name.ends_with("_tr")) {
+        name.remove_suffix(3);
+        retval.is_tr = true;
+    } else {
+        std::array<float*, 3> components = {&retval.light_direction.z, &retval.light_direction.y, &retval.light_direction.x};
+        for (auto* component : components) {
+            const auto token = pop_token();
+            if (!token || !parseDirectionComponent(*token, *component))
+                return std::nullopt;
+        }
+    }
+
+    const auto face = pop_token();
+    if (!face || face->size() != 2 || (face->at(0) != '+' && face->at(0) != '-') || (face->at(1) < 'x' || face->at(1) > 'z'))
+        return std::nullopt;
+
+    retval.face_str = *face;
+    retval.key      = std::format("{}_{}", name, *face);
+    return retval;
+}
+
+std::string identifierOf(std::string_view key, std::string_view face_str)
+{
+    return std::string(key.substr(0, key.size() - face_str.size() - 1));
+}
+
+std::string setKey(const ParsedName& parsed, bool group_faces)
+{
+    return group_faces ? identifierOf(parsed.key, parsed.face_str) : parsed.key;
+}
+
+BakeManifest::BakeManifest(std::filesystem::path path) :
+    path(std::move(path))
+{
+    // "<hash> <key>" per line
+    std::ifstream file(this->path);
+    uint64_t      hash = 0;
+    std::string   key;
+    while (file >> std::hex >> hash && std::getline(file >> std::ws, key))
+        hashes[key] = hash;
+}
+
+bool BakeManifest::upToDate(const std::string& key, uint64_t hash) const
+{
+    auto it = hashes.find(key);
+    return (it != hashes.end()) && (it->second == hash);
+}
+
+HRESULT BakeManifest::save() const
+{
+    auto tmp_path = path;
+    tmp_path += ".tmp";
+    {
+        std::ofstream file(tmp_path, std::ios::trunc);
+        for (auto const& [key, hash] : hashes)
+            file << std::format("{:016x} {}\n", hash, key);
+        if (!file) {
+            spdlog::error("Failed to write {}", tmp_path.string());
+            return E_FAIL;
+        }
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp_path, path, ec);
+    if (ec) {
+        spdlog::error("Failed to replace {}: {}", path.string(), ec.message());
+        return E_FAIL;
+    }
+    return S_OK;
+}
+
+std::optional<LoadedFile> loadInputFile(const std::filesystem::path& path, const NameParser& name_parser)
+{
+    LoadedFile retval;
+    retval.filename = path.filename().string();
+    retval.tex.path = path;
+
+    auto& tex = retval.tex;
+
+    auto parsed = name_parser.parse(retval.filename);
+    if (!parsed) {
+        spdlog::warn("{} does not match the naming pattern.", retval.filename);
+        return std::nullopt;
+    }
+    retval.key           = std::move(parsed->key);
+    retval.face_str      = std::move(parsed->face_str);
+    retval.is_tr         = parsed->is_tr;
+    tex.light_direction  = parsed->light_direction;
+
+    DirectX::TexMetadata metadata;
+    auto                 hr = DirectX::GetMetadataFromDDSFile(path.wstring().c_str(), DirectX::DDS_FLAGS_NONE, metadata);
+    if (FAILED(hr)) {
+        spdlog::warn("Failed to read texture from {}", retval.filename);
+        return std::nullopt;
+    }
+
+    if (metadata.dimension != DirectX::TEX_DIMENSION_TEXTURE2D || metadata.IsCubemap() || metadata.arraySize != 1) {
+        spdlog::warn("{} is not a 2d texture", retval.filename);
+        return std::nullopt;
+    }
+    tex.width  = static_cast<uint32_t>(metadata.width);
+    tex.height = static_cast<uint32_t>(metadata.height);
+    tex.format = metadata.format;
+
+    if (!retval.is_tr)
+        DirectX::XMStoreFloat3(&tex.light_direction, DirectX::XMVector3Normalize(DirectX::XMLoadFloat3(&tex.light_direction)));
+
+    return retval;
+}
+
+HRESULT initColorArray(ID3D11Device*                      device,
+                       std::span<const DirectX::Image>    images,
+                       com_ptr<ID3D11Texture2D>&          tex,
+                       com_ptr<ID3D11ShaderResourceView>& srv)
+{
+    const auto  slice_count = static_cast<uint32_t>(images.size());
+    const auto& first       = images.front();
+
+    if (slice_count > D3D11_REQ_TEXTURE2D_ARRAY_AXIS_DIMENSION) {
+        spdlog::error("Too many color textures ({} > {})", slice_count, D3D11_REQ_TEXTURE2D_ARRAY_AXIS_DIMENSION);
+        return E_INVALIDARG;
+    }
+
+    std::vector<D3D11_SUBRESOURCE_DATA> init_data;
+    init_data.reserve(slice_count);
+    for (auto const& image : images) {
+        init_data.push_back({
+            .pSysMem          = image.pixels,
+            .SysMemPitch      = static_cast<UINT>(image.rowPitch),
+            .SysMemSlicePitch = static_cast<UINT>(image.slicePitch),
+        });
+    }
+
+    D3D11_TEXTURE2D_DESC tex_desc = {
+        .Width          = static_cast<UINT>(first.width),
+        .Height         = static_cast<UINT>(first.height),
+        .MipLevels      = 1,
+        .ArraySize      = slice_count,
+        .Format         = first.format,
+        .SampleDesc     = {.Count = 1, .Quality = 0},
+        .Usage          = D3D11_USAGE_IMMUTABLE,
+        .BindFlags      = D3D11_BIND_SHADER_RESOURCE,
+        .CPUAccessFlags = 0,
+        .MiscFlags      = 0,
+    };
+    tex        = nullptr;
+    srv        = nullptr;
+    HRESULT hr = device->CreateTexture2D(&tex_desc, init_data.data(), tex.put());
+    if (FAILED(hr))
+        return hr;
+
+    D3D11_SHADER_RESOURCE_VIEW_DESC srv_desc = {
+        .Format         = tex_desc.Format,
+        .ViewDimension  = D3D11_SRV_DIMENSION_TEXTURE2DARRAY,
+        .Texture2DArray = {.MostDetailedMip = 0, .MipLevels = 1, .FirstArraySlice = 0, .ArraySize = slice_count},
+    };
+    return device->CreateShaderResourceView(tex.get(), &srv_desc, srv.put());
+}
+
+HRESULT initColorArray(ID3D11Device*                             device,
+                       const std::vector<DirectX::ScratchImage>& images,
+                       com_ptr<ID3D11Texture2D>&                 tex,
+                       com_ptr<ID3D11ShaderResourceView>&        srv)
+{
+    std::vector<DirectX::Image> slices;
+    slices.reserve(images.size());
+    for (auto const& image : images)
+        slices.push_back(*image.GetImage(0, 0, 0));
+    return initColorArray(device, slices, tex, srv);
+}
+
+HRESULT loadInputImage(const std::filesystem::path& path, bool mmap, InputImage& input)
+{
+    const auto use_scratch = [&input]() {
+        input.image              = *input.scratch.GetImage(0, 0, 0);
+        input.metadata           = input.scratch.GetMetadata();
+        input.metadata.mipLevels = 1;
+    };
+
+    if (!mmap) {
+        HRESULT hr = DirectX::LoadFromDDSFile(path.wstring().c_str(), DirectX::DDS_FLAGS_NONE, nullptr, input.scratch);
+        if (SUCCEEDED(hr))
+            use_scratch();
+        return hr;
+    }
+
+    HRESULT hr = input.mapping.open(path);
+    if (SUCCEEDED(hr))
+        hr = DirectX::GetMetadataFromDDSMemory(input.mapping.data(), input.mapping.size(), DirectX::DDS_FLAGS_NONE, input.metadata);
+    if (FAILED(hr))
+        return hr;
+
+    // DDS_HEADER & its DDS_PIXELFORMAT after the magic, the pixels follow, after a DDS_HEADER_DXT10 for "DX10"
+    constexpr size_t   HEADER_SIZE = 4 + 124;
+    constexpr size_t   DXT10_SIZE  = 20;
+    constexpr size_t   PF_FLAGS    = 4 + 76;
+    constexpr size_t   PF_FOURCC   = 4 + 80;
+    constexpr uint32_t DDPF_FOURCC = 0x4;
+    constexpr uint32_t FOURCC_DX10 = 0x30315844; // "DX10"
+
+    size_t row_pitch   = 0;
+    size_t slice_pitch = 0;
+    hr                 = DirectX::ComputePitch(input.metadata.format, input.metadata.width, input.metadata.height, row_pitch, slice_pitch);
+    if (FAILED(hr))
+        return hr;
+
+    uint32_t pf_flags = 0;
+    uint32_t fourcc   = 0;
+    std::memcpy(&pf_flags, input.mapping.data() + PF_FLAGS, sizeof(pf_flags));
+    std::memcpy(&fourcc, input.mapping.data() + PF_FOURCC, sizeof(fourcc));
+    const size_t offset = HEADER_SIZE + ((fourcc == FOURCC_DX10) ? DXT10_SIZE : 0);
+
+    // DirectXTex converts some legacy layouts, those without a fourcc or of another size get decoded from the mapping
+    if ((pf_flags & DDPF_FOURCC) == 0 || offset + slice_pitch > input.mapping.size()) {
+        hr            = DirectX::LoadFromDDSMemory(input.mapping.data(), input.mapping.size(), DirectX::DDS_FLAGS_NONE, nullptr, input.scratch);
+        input.mapping = {};
+        if (SUCCEEDED(hr))
+            use_scratch();
+        return hr;
+    }
+
+    input.mapping.prefetch();
+    input.metadata.mipLevels = 1;
+    input.image              = {
+        .width      = input.metadata.width,
+        .height     = input.metadata.height,
+        .format     = input.metadata.format,
+        .rowPitch   = row_pitch,
+        .slicePitch = slice_pitch,
+        .pixels     = const_cast<uint8_t*>(input.mapping.data() + offset),
+    };
+    return S_OK;
+}
+
+HRESULT initColorArray(ID3D11Device*                      device,
+                       const std::vector<InputImage>&     images,
+                       com_ptr<ID3D11Texture2D>&          tex,
+                       com_ptr<ID3D11ShaderResourceView>& srv)
+{
+    std::vector<DirectX::Image> slices;
+    slices.reserve(images.size());
+    for (auto const& image : images)
+        slices.push_back(image.image);
+    return initColorArray(device, slices, tex, srv);
+}
+
+SetImages readSetImages(const std::string& key, const InputTexSet& tex_set, uint32_t io_threads, bool mmap, Profiler& profiler, uint64_t resident_tr)
+{
+    const auto start = Profiler::Clock::now();
+
+    SetImages retval;
+    retval.face_trs.resize(tex_set.face_trs.size());
+    retval.colors.resize(tex_set.colors.size());
+
+    // tr first, one per face of grouped sets, then the colors
+    const auto           tr_count = std::max<size_t>(1, tex_set.face_trs.size());
+    std::vector<HRESULT> results(tex_set.colors.size() + tr_count, S_OK);
+    parallelFor(results.size(), io_threads, [&](size_t idx) {
+        const bool  grouped = !tex_set.face_trs.empty();
+        const auto& path    = (idx >= tr_count) ? tex_set.colors[idx - tr_count].path : (grouped ? tex_set.face_trs[idx].path : tex_set.tr.path);
+        auto&       image   = (idx >= tr_count) ? retval.colors[idx - tr_count] : (grouped ? retval.face_trs[idx] : retval.tr);
+        if (idx < tr_count && !grouped && resident_tr != 0 && tex_set.tr.content_hash == resident_tr)
+            return;
+        results[idx] = loadInputImage(path, mmap, image);
+        if (FAILED(results[idx]))
+            spdlog::warn("Failed to read texture from {}", path.filename().string());
+    });
+
+    const auto failed = std::ranges::find_if(results, [](HRESULT hr) { return FAILED(hr); });
+    retval.hr         = (failed != results.end()) ? *failed : S_OK;
+
+    profiler.add(key, Stage::kLoad, Profiler::msSince(start));
+    return retval;
+}
+
+HRESULT uploadSet(ID3D11Device* device, const SetImages& images, InputTexSet& tex_set)
+{
+    HRESULT hr = S_OK;
+    if (!images.face_trs.empty()) {
+        com_ptr<ID3D11Texture2D> trs_tex = nullptr; // kept alive by the srv
+        hr                               = initColorArray(device, images.face_trs, trs_tex, tex_set.tr.srv);
+    } else if (tex_set.tr.srv == nullptr) { // set already when shared, see --dedup
+        hr = DirectX::CreateShaderResourceView(device, &images.tr.image, 1, images.tr.metadata, tex_set.tr.srv.put());
+    }
+    if (SUCCEEDED(hr))
+        hr = initColorArray(device, images.colors, tex_set.colors_tex, tex_set.colors_srv);
+    return hr;
+}
+
+void releaseSet(InputTexSet& tex_set)
+{
+    tex_set.tr.srv     = nullptr;
+    tex_set.colors_tex = nullptr;
+    tex_set.colors_srv = nullptr;
+}
+
+size_t dedupColors(std::vector<InputTexture>& colors)
+{
+    std::vector<InputTexture> kept;
+    kept.reserve(colors.size());
+    for (auto& color : colors) {
+        const auto same = std::ranges::find_if(kept, [&color](const InputTexture& other) {
+            return other.content_hash == color.content_hash && other.light_direction.x == color.light_direction.x && other.light_direction.y == color.light_direction.y &&
+                   other.light_direction.z == color.light_direction.z;
+        });
+        if (same != kept.end())
+            same->count += color.count;
+        else
+            kept.push_back(std::move(color));
+    }
+    const auto retval = colors.size() - kept.size();
+    colors            = std::move(kept);
+    return retval;
+}
+
+uint32_t packFaces(std::span<const uint32_t> faces)
+{
+    uint32_t retval = 0;
+    for (size_t i = 0; i < faces.size(); ++i)
+        retval |= faces[i] << (i * 4);
+    return retval;
+}
+
+PackInfo packInfo(const InputTexSet& tex_set)
+{
+    if (tex_set.faces.empty())
+        return {.faces = tex_set.face, .face_count = 1};
+    return {.faces = packFaces(tex_set.faces), .face_count = static_cast<uint32_t>(tex_set.faces.size())};
+}
+
+std::vector<std::string> groupFaces(std::unordered_map<std::string, InputTexSet>& tex_inputs, std::span<const std::string> keys)
+{
+    std::map<std::string, std::vector<InputTexSet*>> identifiers;
+    for (auto const& key : keys)
+        identifiers[tex_inputs.at(key).identifier].push_back(&tex_inputs.at(key));
+
+    const auto by_direction = [](const InputTexture& lhs, const InputTexture& rhs) {
+        return std::tie(lhs.light_direction.x, lhs.light_direction.y, lhs.light_direction.z) < std::tie(rhs.light_direction.x, rhs.light_direction.y, rhs.light_direction.z);
+    };
+    const auto same_direction = [](const InputTexture& lhs, const InputTexture& rhs) {
+        return lhs.light_direction.x == rhs.light_direction.x && lhs.light_direction.y == rhs.light_direction.y && lhs.light_direction.z == rhs.light_direction.z;
+    };
+
+    std::unordered_map<std::string, InputTexSet> grouped;
+    std::vector<std::string>                     retval;
+    for (auto& [identifier, faces] : identifiers) {
+        // the colors of every face share one light buffer, so they go in the same order
+        std::ranges::sort(faces, {}, &InputTexSet::face);
+        for (auto* tex_set : faces)
+            std::ranges::sort(tex_set->colors, by_direction);
+
+        const auto& first = *faces.front();
+        if (!std::ranges::all_of(faces, [&](const InputTexSet* tex_set) {
+                return tex_set->tr.width == first.tr.width && tex_set->tr.height == first.tr.height && tex_set->tr.format == first.tr.format &&
+                       tex_set->colors.front().format == first.colors.front().format && std::ranges::equal(tex_set->colors, first.colors, same_direction);
+            })) {
+            spdlog::warn("Faces of \"{}\" differ in size, format or light directions. Skipping the whole identifier", identifier);
+            continue;
+        }
+
+        auto& merged      = grouped[identifier];
+        merged.face       = first.face;
+        merged.identifier = identifier;
+        merged.tr         = first.tr;
+        for (auto const* tex_set : faces) {
+            merged.faces.push_back(tex_set->face);
+            merged.face_trs.push_back(tex_set->tr);
+            merged.colors.insert(merged.colors.end(), tex_set->colors.begin(), tex_set->colors.end());
+        }
+        spdlog::info("Grouped {} faces of \"{}\"", faces.size(), identifier);
+        retval.push_back(identifier);
+    }
+
+    tex_inputs = std::move(grouped);
+    return retval;
+}
+
+HRESULT DDSRegionReader::open(const std::filesystem::path& path_)
+{
+    path = path_;
+    file = winrt::file_handle{CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr)};
+    LARGE_INTEGER file_size = {};
+    if (!file || !GetFileSizeEx(file.get(), &file_size))
+        return HRESULT_FROM_WIN32(GetLastError());
+
+    // magic + DDS_HEADER, followed by DDS_HEADER_DXT10 if the pixel format fourcc is "DX10"
+    constexpr size_t HEADER_SIZE      = 4 + 124;
+    constexpr size_t DX10_HEADER_SIZE = 20;
+    constexpr size_t FOURCC_OFFSET    = 4 + 80;
+
+    std::array<uint8_t, HEADER_SIZE + DX10_HEADER_SIZE> header      = {};
+    const auto                                          header_size = std::min<size_t>(header.size(), static_cast<size_t>(file_size.QuadPart));
+    HRESULT                                             hr          = readAt(0, header.data(), header_size);
+    if (FAILED(hr))
+        return hr;
+
+    DirectX::TexMetadata metadata;
+    DirectX::TexMetadata stored_metadata;
+    hr = DirectX::GetMetadataFromDDSMemory(header.data(), header_size, DirectX::DDS_FLAGS_NONE, metadata);
+    if (FAILED(hr))
+        return hr;
+    if (FAILED(DirectX::GetMetadataFromDDSMemory(header.data(), header_size, DirectX::DDS_FLAGS_NO_LEGACY_EXPANSION, stored_metadata)) || stored_metadata.format != metadata.format) {
+        spdlog::error("{} is in a legacy layout that can not be read in tiles", path.filename().string());
+        return E_NOTIMPL;
+    }
+    if (DirectX::IsCompressed(metadata.format) || DirectX::BitsPerPixel(metadata.format) % 8 != 0) {
+        spdlog::error("{} has a format that can not be read in tiles", path.filename().string());
+        return E_NOTIMPL;
+    }
+
+    size_t slice_pitch = 0;
+    hr                 = DirectX::ComputePitch(metadata.format, metadata.width, metadata.height, row_pitch, slice_pitch);
+    if (FAILED(hr))
+        return hr;
+
+    const std::string_view fourcc{reinterpret_cast<const char*>(header.data() + FOURCC_OFFSET), 4};
+    data_offset = HEADER_SIZE + ((fourcc == "DX10") ? DX10_HEADER_SIZE : 0);
+    if (data_offset + slice_pitch > static_cast<uint64_t>(file_size.QuadPart)) {
+        spdlog::error("{} is truncated", path.filename().string());
+        return E_FAIL;
+    }
+
+    format      = metadata.format;
+    file_width  = static_cast<uint32_t>(metadata.width);
+    file_height = static_cast<uint32_t>(metadata.height);
+    pixel_bytes = DirectX::BitsPerPixel(metadata.format) / 8;
+    return S_OK;
+}
+
+HRESULT DDSRegionReader::read(uint32_t x, uint32_t y, uint32_t width, uint32_t height, DirectX::ScratchImage& image) const
+{
+    if (x + width > file_width || y + height > file_height)
+        return E_INVALIDARG;
+
+    HRESULT hr = image.Initialize2D(format, width, height, 1, 1);
+    if (FAILED(hr))
+        return hr;
+
+    // whole rows are contiguous in the file, so read at once
+    const auto*  img       = image.GetImage(0, 0, 0);
+    const size_t row_bytes = width * pixel_bytes;
+    if (row_bytes == row_pitch && img->rowPitch == row_pitch) {
+        hr = readAt(data_offset + (y * row_pitch), img->pixels, row_pitch * height);
+    } else {
+        for (size_t row = 0; SUCCEEDED(hr) && row < height; ++row)
+            hr = readAt(data_offset + ((y + row) * row_pitch) + (x * pixel_bytes), img->pixels + (row * img->rowPitch), row_bytes);
+    }
+    if (FAILED(hr))
+        spdlog::error("Failed to read region of {}", path.filename().string());
+    return hr;
+}
+
+HRESULT DDSRegionReader::readAt(uint64_t offset, uint8_t* dst, size_t size) const
+{
+    // ReadFile takes a DWORD of bytes
+    constexpr size_t MAX_READ = size_t{1} << 30;
+
+    while (size > 0) {
+        OVERLAPPED overlapped = {};
+        overlapped.Offset     = static_cast<DWORD>(offset);
+        overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+        DWORD read = 0;
+        if (!ReadFile(file.get(), dst, static_cast<DWORD>(std::min(size, MAX_READ)), &read, &overlapped))
+            return HRESULT_FROM_WIN32(GetLastError());
+        if (read == 0)
+            return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+        offset += read;
+        dst += read;
+        size -= read;
+    }
+    return S_OK;
+}
+
+HRESULT openSetRegions(const std::string& key, const InputTexSet& tex_set, uint32_t io_threads, Profiler& profiler, SetRegionReaders& readers)
+{
+    ScopedTimer timer(profiler, key, Stage::kLoad);
+
+    // tr first, then the colors
+    readers.colors.resize(tex_set.colors.size());
+    std::vector<HRESULT> results(tex_set.colors.size() + 1, S_OK);
+    parallelFor(results.size(), io_threads, [&](size_t idx) {
+        const auto& path = (idx == 0) ? tex_set.tr.path : tex_set.colors[idx - 1].path;
+        results[idx]     = ((idx == 0) ? readers.tr : readers.colors[idx - 1]).open(path);
+        if (FAILED(results[idx]))
+            spdlog::warn("Failed to open {}", path.filename().string());
+    });
+
+    const auto failed = std::ranges::find_if(results, [](HRESULT hr) { return FAILED(hr); });
+    return (failed != results.end()) ? *failed : S_OK;
+}
+
+TileImages readTileImages(const std::string& key, const SetRegionReaders& readers, uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint32_t io_threads, Profiler& profiler)
+{
+    const auto start = Profiler::Clock::now();
+
+    TileImages retval;
+    retval.colors.resize(readers.colors.size());
+
+    // tr first, then the colors
+    std::vector<HRESULT> results(readers.colors.size() + 1, S_OK);
+    parallelFor(results.size(), io_threads, [&](size_t idx) {
+        results[idx] = (idx == 0) ? readers.tr.read(x, y, width, height, retval.tr) : readers.colors[idx - 1].read(x, y, width, height, retval.colors[idx - 1]);
+    });
+
+    const auto failed = std::ranges::find_if(results, [](HRESULT hr) { return FAILED(hr); });
+    retval.hr         = (failed != results.end()) ? *failed : S_OK;
+
+    profiler.add(key, Stage::kLoad, Profiler::msSince(start));
+    return retval;
+}
@@ -0,0 +1,215 @@
+#pragma once
+// Input discovery & reading: file names, headers, pixels & their upload, see --tr-pattern, --mmap & --group-faces.
+
+#include <memory>
+#include <optional>
+#include <unordered_map>
+
+#include <RE2/re2.h>
+
+#include "lib/common.h"
+
+struct ParsedName {
+    std::string       key; // "(identifier)_(face)"
+    std::string       face_str;
+    bool              is_tr           = false;
+    DirectX::XMFLOAT3 light_direction = {1.F, 0.F, 0.F}; // not normalized, colors only
+};
+
+// input file names, see --tr-pattern & --color-pattern
+class NameParser {
+public:
+    // the default patterns, matched by hand unless custom ones are given
+    static constexpr auto DEFAULT_TR_PATTERN    = R"(^(.*)_([+-][xyz])_tr.dds$)";
+    static constexpr auto DEFAULT_COLOR_PATTERN = R"(^(.*)_([+-][xyz])_([+-]?(?:\d*\.\d+|\d+\.\d*|\d+))_([+-]?(?:\d*\.\d+|\d+\.\d*|\d+))_([+-]?(?:\d*\.\d+|\d+\.\d*|\d+)).dds$)";
+
+    // empty patterns use the defaults
+    NameParser(const std::string& tr_pattern, const std::string& color_pattern);
+
+    [[nodiscard]] bool ok() const { return !tr_re || (tr_re->ok() && color_re->ok()); }
+
+    std::optional<ParsedName> parse(const std::string& filename) const;
+
+private:
+    std::optional<ParsedName> parseRE2(const std::string& filename) const;
+
+    // from the back, as the identifier takes everything else
+    static std::optional<ParsedName> parseDefault(std::string_view name);
+
+    std::unique_ptr<RE2> tr_re    = nullptr;
+    std::unique_ptr<RE2> color_re = nullptr;
+};
+
+// of a "(identifier)_(face)" key, face_str is as captured by the pattern
+std::string identifierOf(std::string_view key, std::string_view face_str);
+
+// the set a file belongs to, its whole identifier with --group-faces
+std::string setKey(const ParsedName& parsed, bool group_faces);
+
+// hash of the inputs & settings each output was baked from, kept next to the outputs, see --incremental
+class BakeManifest {
+public:
+    explicit BakeManifest(std::filesystem::path path);
+
+    [[nodiscard]] bool upToDate(const std::string& key, uint64_t hash) const;
+
+    void set(const std::string& key, uint64_t hash) { hashes[key] = hash; }
+
+    // written aside & renamed, an interrupted run leaves the old manifest intact
+    HRESULT save() const;
+
+private:
+    std::filesystem::path           path;
+    std::map<std::string, uint64_t> hashes;
+};
+
+// matches the naming pattern and reads the header, safe to call from worker threads
+// pixels are read just before the set gets baked, see readSetImages
+std::optional<LoadedFile> loadInputFile(const std::filesystem::path& path, const NameParser& name_parser);
+
+// packs same-sized color images into one texture array, uploaded at once
+HRESULT initColorArray(ID3D11Device*                      device,
+                       std::span<const DirectX::Image>    images,
+                       com_ptr<ID3D11Texture2D>&          tex,
+                       com_ptr<ID3D11ShaderResourceView>& srv);
+
+HRESULT initColorArray(ID3D11Device*                             device,
+                       const std::vector<DirectX::ScratchImage>& images,
+                       com_ptr<ID3D11Texture2D>&                 tex,
+                       com_ptr<ID3D11ShaderResourceView>&        srv);
+
+// a read only view of a whole file, unmapped on destruction, see --mmap
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&)            = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other) noexcept : view(std::exchange(other.view, nullptr)), view_size(std::exchange(other.view_size, 0)) {}
+    MappedFile& operator=(MappedFile&& other) noexcept
+    {
+        std::swap(view, other.view);
+        std::swap(view_size, other.view_size);
+        return *this;
+    }
+    ~MappedFile()
+    {
+        if (view != nullptr)
+            UnmapViewOfFile(view);
+    }
+
+    HRESULT open(const std::filesystem::path& path)
+    {
+        // the view keeps the file & the mapping open once they are closed
+        winrt::file_handle file{CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr)};
+        LARGE_INTEGER      file_size = {};
+        if (!file || !GetFileSizeEx(file.get(), &file_size))
+            return HRESULT_FROM_WIN32(GetLastError());
+
+        winrt::handle mapping{CreateFileMappingW(file.get(), nullptr, PAGE_READONLY, 0, 0, nullptr)};
+        if (!mapping)
+            return HRESULT_FROM_WIN32(GetLastError());
+
+        view = MapViewOfFile(mapping.get(), FILE_MAP_READ, 0, 0, 0);
+        if (view == nullptr)
+            return HRESULT_FROM_WIN32(GetLastError());
+        view_size = static_cast<size_t>(file_size.QuadPart);
+        return S_OK;
+    }
+
+    // starts reading all pages in, so the upload does not fault them in one at a time on the device thread
+    void prefetch() const
+    {
+        WIN32_MEMORY_RANGE_ENTRY range = {.VirtualAddress = view, .NumberOfBytes = view_size};
+        PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+    }
+
+    const uint8_t* data() const { return static_cast<const uint8_t*>(view); }
+    size_t         size() const { return view_size; }
+
+private:
+    void*  view      = nullptr;
+    size_t view_size = 0;
+};
+
+// an input texture's top mip, decoded into scratch, or with --mmap pointing into mapping where the dds needs no conversion
+struct InputImage {
+    DirectX::ScratchImage scratch;
+    MappedFile            mapping;
+    DirectX::TexMetadata  metadata = {}; // of image alone, a single mip
+    DirectX::Image        image    = {}; // never written through when mapped
+};
+
+HRESULT loadInputImage(const std::filesystem::path& path, bool mmap, InputImage& input);
+
+// inputs of a set, read or mapped, see --mmap
+struct SetImages {
+    HRESULT                 hr = S_OK;
+    InputImage              tr;
+    std::vector<InputImage> face_trs; // --group-faces, instead of tr
+    std::vector<InputImage> colors;
+};
+
+HRESULT initColorArray(ID3D11Device*                      device,
+                       const std::vector<InputImage>&     images,
+                       com_ptr<ID3D11Texture2D>&          tex,
+                       com_ptr<ID3D11ShaderResourceView>& srv);
+
+// with --dedup, the tr is not read when its content is resident_tr, as the device still has it, see D3dObjs::shared_tr
+SetImages readSetImages(const std::string& key, const InputTexSet& tex_set, uint32_t io_threads, bool mmap, Profiler& profiler, uint64_t resident_tr = 0);
+
+HRESULT uploadSet(ID3D11Device* device, const SetImages& images, InputTexSet& tex_set);
+
+void releaseSet(InputTexSet& tex_set);
+
+// --dedup, collapses colors of the same light direction & content into the first of them, which then counts for all
+// returns how many were dropped, the order is kept
+size_t dedupColors(std::vector<InputTexture>& colors);
+
+// BakeCBData::faces, 4 bits per slice
+uint32_t packFaces(std::span<const uint32_t> faces);
+
+PackInfo packInfo(const InputTexSet& tex_set);
+
+// --group-faces, merges the checked per face sets of keys into one set per identifier, faces in +x, -x, +y, -y, +z order
+// faces have to match in size, formats & light directions, identifiers where they do not are skipped
+std::vector<std::string> groupFaces(std::unordered_map<std::string, InputTexSet>& tex_inputs, std::span<const std::string> keys);
+
+// an uncompressed dds opened once, regions of mip 0 / slice 0 are read straight from the file, see --tile-size
+// the metadata is read like loadInputFile does, legacy layouts DirectXTex would expand are rejected as their pixels are not stored as such
+// reads are positional, so readers of different files can read on different threads
+class DDSRegionReader {
+public:
+    HRESULT open(const std::filesystem::path& path);
+
+    HRESULT read(uint32_t x, uint32_t y, uint32_t width, uint32_t height, DirectX::ScratchImage& image) const;
+
+private:
+    HRESULT readAt(uint64_t offset, uint8_t* dst, size_t size) const;
+
+    std::filesystem::path path;
+    winrt::file_handle    file;
+    DXGI_FORMAT           format      = DXGI_FORMAT_UNKNOWN;
+    uint32_t              file_width  = 0;
+    uint32_t              file_height = 0;
+    size_t                data_offset = 0;
+    size_t                row_pitch   = 0;
+    size_t                pixel_bytes = 0;
+};
+
+// the inputs of a set, opened once before its tiles
+struct SetRegionReaders {
+    DDSRegionReader              tr;
+    std::vector<DDSRegionReader> colors;
+};
+
+HRESULT openSetRegions(const std::string& key, const InputTexSet& tex_set, uint32_t io_threads, Profiler& profiler, SetRegionReaders& readers);
+
+// one tile of every input of a set
+struct TileImages {
+    HRESULT                            hr = S_OK;
+    DirectX::ScratchImage              tr;
+    std::vector<DirectX::ScratchImage> colors;
+};
+
+// reads the region of every input like readSetImages, io_threads at a time
+TileImages readTileImages(const std::string& key, const SetRegionReaders& readers, uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint32_t io_threads, Profiler& profiler);
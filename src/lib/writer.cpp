@@ -0,0 +1,451 @@
+#include "lib/writer.h"
+
+#include <cstring>
+#include <ranges>
+
+namespace {
+HRESULT compressBC6H(const DirectX::ScratchImage& image, DirectX::ScratchImage& compressed_image, Profiler& profiler, std::string_view set)
+{
+    ScopedTimer timer(profiler, set, Stage::kCompress);
+    HRESULT     hr = DirectX::Compress(
+        image.GetImages(),
+        image.GetImageCount(),
+        image.GetMetadata(),
+        DXGI_FORMAT_BC6H_SF16, // BC6H format
+        DirectX::TEX_COMPRESS_DEFAULT,
+        1.0F,
+        compressed_image);
+
+    if (FAILED(hr))
+        spdlog::error("Failed to compress texture to BC6H");
+    return hr;
+}
+} // namespace
+
+HRESULT saveImageToDDS(const DirectX::ScratchImage& image, const std::filesystem::path& out_path, bool compressed, Profiler& profiler, std::string_view set)
+{
+    HRESULT hr = S_OK;
+
+    // Compress to BC6H format
+    DirectX::ScratchImage compressed_image;
+    if (compressed) {
+        hr = compressBC6H(image, compressed_image, profiler, set);
+        if (FAILED(hr))
+            return hr;
+    }
+
+    const auto& target_image = compressed ? compressed_image : image;
+
+    // Save to DDS file
+    {
+        ScopedTimer timer(profiler, set, Stage::kSave);
+        hr = DirectX::SaveToDDSFile(
+            target_image.GetImages(),
+            target_image.GetImageCount(),
+            target_image.GetMetadata(),
+            DirectX::DDS_FLAGS_NONE,
+            out_path.wstring().c_str());
+    }
+
+    if (FAILED(hr)) {
+        spdlog::error("Failed to save DDS file");
+        return hr;
+    }
+
+    return S_OK;
+}
+
+com_ptr<ID3D11Texture2D> acquireStagingTex(ID3D11Device* device, ShTexturePool& pool, const D3D11_TEXTURE2D_DESC& desc)
+{
+    return pool.acquire(desc.Width, desc.Height, desc.ArraySize, desc.Format, [&]() {
+        D3D11_TEXTURE2D_DESC staging_desc = {
+            .Width          = desc.Width,
+            .Height         = desc.Height,
+            .MipLevels      = 1,
+            .ArraySize      = desc.ArraySize,
+            .Format         = desc.Format,
+            .SampleDesc     = {.Count = 1, .Quality = 0},
+            .Usage          = D3D11_USAGE_STAGING,
+            .BindFlags      = 0,
+            .CPUAccessFlags = D3D11_CPU_ACCESS_READ,
+            .MiscFlags      = 0,
+        };
+        ShTexture retval;
+        DX::ThrowIfFailed(device->CreateTexture2D(&staging_desc, nullptr, retval.tex.put()));
+        return retval;
+    })
+        .tex;
+}
+
+HRESULT mapStaging(ID3D11DeviceContext* context, ID3D11Texture2D* staging, UINT map_flags, ImagePool& images, DXGI_FORMAT format, size_t width, size_t height,
+                   DirectX::ScratchImage& image)
+{
+    D3D11_TEXTURE2D_DESC desc;
+    staging->GetDesc(&desc);
+
+    for (UINT i = 0; i < desc.ArraySize; ++i) {
+        // the copy is done once the first slice maps, the others need no flags
+        D3D11_MAPPED_SUBRESOURCE mapped;
+        HRESULT                  hr = context->Map(staging, D3D11CalcSubresource(0, i, 1), D3D11_MAP_READ, (i == 0) ? map_flags : 0, &mapped);
+        if (FAILED(hr))
+            return hr;
+        if (i == 0)
+            hr = images.acquire(format, width, height, desc.ArraySize, image);
+        if (FAILED(hr)) {
+            context->Unmap(staging, D3D11CalcSubresource(0, i, 1));
+            return hr;
+        }
+
+        const auto* img       = image.GetImage(0, i, 0);
+        const auto  row_bytes = std::min<size_t>(img->rowPitch, mapped.RowPitch);
+        const auto  rows      = DirectX::ComputeScanlines(format, img->height);
+        for (size_t row = 0; row < rows; ++row)
+            std::memcpy(img->pixels + (row * img->rowPitch), static_cast<const uint8_t*>(mapped.pData) + (row * mapped.RowPitch), row_bytes);
+
+        context->Unmap(staging, D3D11CalcSubresource(0, i, 1));
+    }
+    return S_OK;
+}
+
+HRESULT PackWriter::open(const std::filesystem::path& path, uint32_t order)
+{
+    sh_order = order;
+    file.open(path, std::ios::binary | std::ios::trunc);
+    const PackHeader header;
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    end = sizeof(header);
+    return file ? S_OK : E_FAIL;
+}
+
+HRESULT PackWriter::append(std::string_view key, const DirectX::ScratchImage& image, const PackInfo& info)
+{
+    const auto& metadata = image.GetMetadata();
+
+    std::lock_guard lock(mutex);
+    const uint64_t  offset = (end + PACK_ALIGNMENT - 1) / PACK_ALIGNMENT * PACK_ALIGNMENT;
+    pad(offset);
+    file.write(reinterpret_cast<const char*>(image.GetPixels()), static_cast<std::streamsize>(image.GetPixelsSize()));
+    end = offset + image.GetPixelsSize();
+
+    entries.push_back({
+        .entry{
+            .offset     = offset,
+            .size       = image.GetPixelsSize(),
+            .width      = static_cast<uint32_t>(metadata.width),
+            .height     = static_cast<uint32_t>(metadata.height),
+            .slices     = static_cast<uint32_t>(metadata.arraySize),
+            .format     = static_cast<uint32_t>(metadata.format),
+            .faces      = info.faces,
+            .face_count = info.face_count,
+            .sh_order   = sh_order,
+        },
+        .key = std::string(key),
+    });
+    return file ? S_OK : E_FAIL;
+}
+
+HRESULT PackWriter::close()
+{
+    std::ranges::sort(entries, {}, &KeyedEntry::key);
+
+    uint32_t key_offset = 0;
+    for (auto& [entry, key] : entries) {
+        entry.key_offset = key_offset;
+        entry.key_size   = static_cast<uint32_t>(key.size());
+        key_offset += entry.key_size;
+    }
+
+    PackHeader header{.index_offset = (end + alignof(PackEntry) - 1) / alignof(PackEntry) * alignof(PackEntry), .entry_count = static_cast<uint32_t>(entries.size())};
+    pad(header.index_offset);
+    for (auto const& [entry, key] : entries)
+        file.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+    for (auto const& [entry, key] : entries)
+        file.write(key.data(), static_cast<std::streamsize>(key.size()));
+
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.close();
+    return file ? S_OK : E_FAIL;
+}
+
+void PackWriter::pad(uint64_t offset)
+{
+    static constexpr std::array<char, PACK_ALIGNMENT> ZEROS = {};
+    file.write(ZEROS.data(), static_cast<std::streamsize>(offset - end));
+    end = offset;
+}
+
+SavePipeline::SavePipeline(ID3D11Device* device, ID3D11DeviceContext* context, Profiler& profiler, uint32_t staging_count, uint32_t writer_count, uint32_t queue_capacity, PackWriter* pack,
+                           ReadbackPools* pools) :
+    device(device), context(context), profiler(profiler), pack(pack), pools((pools != nullptr) ? pools : &own_pools), slots(std::max(1U, staging_count)), queue_capacity(std::max(1U, queue_capacity))
+{
+    writer_count = std::max(1U, writer_count);
+    writers.reserve(writer_count);
+    for (uint32_t i = 0; i < writer_count; ++i)
+        writers.emplace_back([this]() { writerLoop(); });
+}
+
+void SavePipeline::enqueue(ID3D11Texture2D* tex, std::string set, std::filesystem::path out_path, SaveFormat format, uint32_t width, uint32_t height, PackInfo pack_info)
+{
+    enqueueSlot(tex, std::move(set), std::move(out_path), format, width, height, pack_info, {});
+}
+
+void SavePipeline::enqueueTile(ID3D11Texture2D* tex, std::string set, TiledDDSWriter* tiled, uint32_t x, uint32_t y, SaveFormat format, uint32_t width, uint32_t height)
+{
+    enqueueSlot(tex, std::move(set), {}, format, width, height, {}, {.writer = tiled, .x = x, .y = y});
+}
+
+void SavePipeline::enqueueSlot(ID3D11Texture2D* tex, std::string set, std::filesystem::path out_path, SaveFormat format, uint32_t width, uint32_t height, PackInfo pack_info, TileTarget tile)
+{
+    poll();
+
+    auto& slot = slots[next_slot];
+    next_slot  = (next_slot + 1) % slots.size();
+
+    if (slot.pending)
+        readback(slot, 0);
+
+    D3D11_TEXTURE2D_DESC desc;
+    tex->GetDesc(&desc);
+    if (slot.tex == nullptr || desc.Width != slot.desc.Width || desc.Height != slot.desc.Height || desc.ArraySize != slot.desc.ArraySize || desc.Format != slot.desc.Format) {
+        pools->staging.release({.tex = std::move(slot.tex)});
+        slot.desc = desc;
+        slot.tex  = acquireStagingTex(device, pools->staging, desc);
+    }
+
+    context->CopyResource(slot.tex.get(), tex);
+    context->Flush(); // get the gpu going while we map older slots
+
+    slot.set       = std::move(set);
+    slot.out_path  = std::move(out_path);
+    slot.format    = format;
+    slot.width     = (format == SaveFormat::kBlocksBC6H) ? width : desc.Width;
+    slot.height    = (format == SaveFormat::kBlocksBC6H) ? height : desc.Height;
+    slot.pack_info = pack_info;
+    slot.tile      = tile;
+    slot.pending   = true;
+}
+
+void SavePipeline::enqueueImage(DirectX::ScratchImage image, std::string set, std::filesystem::path out_path, bool compressed, PackInfo pack_info)
+{
+    push({.image = std::move(image), .set = std::move(set), .out_path = std::move(out_path), .compressed = compressed, .pack_info = pack_info});
+}
+
+HRESULT SavePipeline::finish()
+{
+    if (finished)
+        return first_error;
+    finished = true;
+
+    for (size_t i = 0; i < slots.size(); ++i) {
+        auto& slot = slots[(next_slot + i) % slots.size()];
+        if (slot.pending)
+            readback(slot, 0);
+    }
+    for (auto& slot : slots)
+        pools->staging.release({.tex = std::move(slot.tex)});
+
+    {
+        std::lock_guard lock(mutex);
+        closing = true;
+    }
+    not_empty.notify_all();
+    writers.clear(); // joins
+
+    return first_error;
+}
+
+void SavePipeline::poll()
+{
+    for (size_t i = 0; i < slots.size(); ++i) {
+        auto& slot = slots[(next_slot + i) % slots.size()];
+        if (!slot.pending)
+            continue;
+        if (queueFull() || !readback(slot, D3D11_MAP_FLAG_DO_NOT_WAIT))
+            return; // later copies were issued after this one
+    }
+}
+
+bool SavePipeline::readback(StagingSlot& slot, UINT map_flags)
+{
+    const auto format = (slot.format == SaveFormat::kBlocksBC6H) ? DXGI_FORMAT_BC6H_SF16 : slot.desc.Format;
+    const auto start  = Profiler::Clock::now(); // includes waiting for the gpu to finish the copy
+
+    DirectX::ScratchImage image;
+    HRESULT               hr = mapStaging(context, slot.tex.get(), map_flags, pools->images, format, slot.width, slot.height, image);
+    if (hr == DXGI_ERROR_WAS_STILL_DRAWING)
+        return false;
+
+    slot.pending = false;
+    WriteJob job{
+        .image      = std::move(image),
+        .set        = std::move(slot.set),
+        .out_path   = std::move(slot.out_path),
+        .compressed = (slot.format == SaveFormat::kCompressCpu),
+        .pack_info  = slot.pack_info,
+        .tile       = slot.tile,
+        .pooled     = true,
+    };
+    if (FAILED(hr)) {
+        spdlog::error("Failed to read back texture for {}", job.tile.writer != nullptr ? job.set : job.out_path.string());
+        recordError(hr);
+        return true;
+    }
+    profiler.add(job.set, Stage::kReadback, Profiler::msSince(start));
+    push(std::move(job));
+    return true;
+}
+
+bool SavePipeline::queueFull()
+{
+    std::lock_guard lock(mutex);
+    return queue.size() >= queue_capacity;
+}
+
+void SavePipeline::push(WriteJob job)
+{
+    std::unique_lock lock(mutex);
+    not_full.wait(lock, [this]() { return queue.size() < queue_capacity; });
+    queue.push_back(std::move(job));
+    lock.unlock();
+    not_empty.notify_one();
+}
+
+void SavePipeline::writerLoop()
+{
+    while (true) {
+        std::unique_lock lock(mutex);
+        not_empty.wait(lock, [this]() { return closing || !queue.empty(); });
+        if (queue.empty())
+            return; // closing
+        auto job = std::move(queue.front());
+        queue.pop_front();
+        lock.unlock();
+        not_full.notify_one();
+
+        HRESULT hr = S_OK;
+        if (job.tile.writer != nullptr) {
+            hr = writeTile(job);
+        } else if (pack != nullptr && job.pack_info.face_count > 0) {
+            hr = packImage(job);
+            if (SUCCEEDED(hr))
+                spdlog::info("Packed {}", job.set);
+        } else {
+            hr = saveImageToDDS(job.image, job.out_path, job.compressed, profiler, job.set);
+            if (SUCCEEDED(hr))
+                spdlog::info("Saved {}", job.out_path.filename().string());
+        }
+        if (FAILED(hr))
+            recordError(hr);
+        if (job.pooled)
+            pools->images.release(std::move(job.image));
+    }
+}
+
+HRESULT SavePipeline::packImage(const WriteJob& job)
+{
+    DirectX::ScratchImage compressed_image;
+    if (job.compressed) {
+        HRESULT hr = compressBC6H(job.image, compressed_image, profiler, job.set);
+        if (FAILED(hr))
+            return hr;
+    }
+
+    ScopedTimer timer(profiler, job.set, Stage::kSave);
+    HRESULT     hr = pack->append(job.set, job.compressed ? compressed_image : job.image, job.pack_info);
+    if (FAILED(hr))
+        spdlog::error("Failed to append {} to the pack", job.set);
+    return hr;
+}
+
+HRESULT SavePipeline::writeTile(const WriteJob& job)
+{
+    DirectX::ScratchImage compressed_image;
+    if (job.compressed) {
+        HRESULT hr = compressBC6H(job.image, compressed_image, profiler, job.set);
+        if (FAILED(hr))
+            return hr;
+    }
+
+    ScopedTimer timer(profiler, job.set, Stage::kSave);
+    const auto& blocks   = job.compressed ? compressed_image : job.image;
+    const auto& metadata = blocks.GetMetadata();
+    HRESULT     hr       = S_OK;
+    for (size_t slice = 0; SUCCEEDED(hr) && slice < metadata.arraySize; ++slice) {
+        const auto* img = blocks.GetImage(0, slice, 0);
+        hr              = job.tile.writer->writeBlocks(static_cast<uint32_t>(slice), job.tile.x, job.tile.y, img->pixels, img->rowPitch,
+                                                       static_cast<uint32_t>((metadata.width + 3) / 4), static_cast<uint32_t>((metadata.height + 3) / 4));
+    }
+    if (FAILED(hr))
+        spdlog::error("Failed to write tile ({}, {}) of {}", job.tile.x, job.tile.y, job.set);
+    return hr;
+}
+
+void SavePipeline::recordError(HRESULT hr)
+{
+    std::lock_guard lock(mutex);
+    if (SUCCEEDED(first_error))
+        first_error = hr;
+}
+
+HRESULT TiledDDSWriter::open(const std::filesystem::path& path_, uint32_t width, uint32_t height, uint32_t array_size)
+{
+    DirectX::TexMetadata metadata = {
+        .width      = width,
+        .height     = height,
+        .depth      = 1,
+        .arraySize  = array_size,
+        .mipLevels  = 1,
+        .miscFlags  = 0,
+        .miscFlags2 = 0,
+        .format     = DXGI_FORMAT_BC6H_SF16,
+        .dimension  = DirectX::TEX_DIMENSION_TEXTURE2D,
+    };
+
+    HRESULT hr = DirectX::ComputePitch(metadata.format, width, height, row_pitch, slice_pitch);
+    if (FAILED(hr))
+        return hr;
+
+    hr = DirectX::EncodeDDSHeader(metadata, DirectX::DDS_FLAGS_NONE, nullptr, 0, data_offset);
+    if (FAILED(hr))
+        return hr;
+    std::vector<uint8_t> header(data_offset);
+    hr = DirectX::EncodeDDSHeader(metadata, DirectX::DDS_FLAGS_NONE, header.data(), header.size(), data_offset);
+    if (FAILED(hr))
+        return hr;
+
+    path = path_;
+    file.open(path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(header.data()), static_cast<std::streamsize>(header.size()));
+    // extend to full size
+    file.seekp(static_cast<std::streamoff>(data_offset + (slice_pitch * array_size) - 1));
+    file.put(0);
+
+    return file ? S_OK : E_FAIL;
+}
+
+HRESULT TiledDDSWriter::writeBlocks(uint32_t slice, uint32_t x, uint32_t y, const uint8_t* blocks, size_t src_row_pitch, uint32_t blocks_x, uint32_t blocks_y)
+{
+    std::lock_guard lock(mutex);
+    for (uint32_t row = 0; row < blocks_y; ++row) {
+        file.seekp(static_cast<std::streamoff>(data_offset + (slice * slice_pitch) + ((y / 4 + row) * row_pitch) + (x / 4 * BLOCK_SIZE)));
+        file.write(reinterpret_cast<const char*>(blocks + (row * src_row_pitch)), static_cast<std::streamsize>(blocks_x * BLOCK_SIZE));
+    }
+    return file ? S_OK : E_FAIL;
+}
+
+HRESULT TiledDDSWriter::close()
+{
+    file.close();
+    return file ? S_OK : E_FAIL;
+}
+
+void TiledDDSWriter::discard()
+{
+    if (path.empty())
+        return;
+    file.close();
+    std::error_code ec;
+    std::filesystem::remove(path, ec);
+    path.clear();
+}
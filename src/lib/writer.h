@@ -0,0 +1,209 @@
+#pragma once
+// Output writing: read backs, compression & saving off the device thread, the --pack file & tiled outputs.
+
+#include <condition_variable>
+#include <deque>
+
+#include <d3d12.h>
+
+#include "lib/common.h"
+
+HRESULT saveImageToDDS(const DirectX::ScratchImage& image, const std::filesystem::path& out_path, bool compressed, Profiler& profiler, std::string_view set);
+
+// a staging texture to read back textures like desc, from pool
+com_ptr<ID3D11Texture2D> acquireStagingTex(ID3D11Device* device, ShTexturePool& pool, const D3D11_TEXTURE2D_DESC& desc);
+
+// copies every slice of staging into an image of format, width & height from images
+// with D3D11_MAP_FLAG_DO_NOT_WAIT, DXGI_ERROR_WAS_STILL_DRAWING while the copy into staging runs, image is left alone then
+HRESULT mapStaging(ID3D11DeviceContext* context, ID3D11Texture2D* staging, UINT map_flags, ImagePool& images, DXGI_FORMAT format, size_t width, size_t height,
+                   DirectX::ScratchImage& image);
+
+enum class SaveFormat : uint8_t {
+    kRaw,         // as is
+    kCompressCpu, // BC6H through DirectXTex on the writer threads
+    kBlocksBC6H,  // already BC6H blocks stored as R32G32B32A32_UINT, see BC6H.cs.hlsl
+};
+
+// --pack, the sh output of every set appended to a single file instead of one dds each
+// layout: PackHeader, the sets' data each at a multiple of PACK_ALIGNMENT, PackEntry[entry_count] sorted by key, then the keys
+// everything is little endian & naturally aligned, so consumers can map the file & use it in place
+constexpr uint64_t PACK_ALIGNMENT = D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT;
+
+struct PackHeader {
+    char     magic[4]     = {'C', 'B', 'P', 'K'};
+    uint32_t version      = 1;
+    uint64_t index_offset = 0; // of the entries, 0 until the pack is closed
+    uint32_t entry_count  = 0;
+    uint32_t reserved     = 0;
+};
+
+struct PackEntry {
+    uint64_t offset     = 0; // of the first slice, the others follow with rows of whole blocks & no padding
+    uint64_t size       = 0; // of all slices
+    uint32_t key_offset = 0; // into the keys after the entries, not null terminated
+    uint32_t key_size   = 0;
+    uint32_t width      = 0;
+    uint32_t height     = 0;
+    uint32_t slices     = 0; // of all faces, face_count * shSlices(sh_order)
+    uint32_t format     = 0; // DXGI_FORMAT
+    uint32_t faces      = 0; // see PackInfo
+    uint32_t face_count = 0;
+    uint32_t sh_order   = 0;
+    uint32_t reserved   = 0;
+};
+static_assert(sizeof(PackHeader) == 24 && sizeof(PackEntry) == 56);
+
+// appends are sequential & under a lock, so any writer thread of any device can append
+class PackWriter {
+public:
+    HRESULT open(const std::filesystem::path& path, uint32_t order);
+
+    HRESULT append(std::string_view key, const DirectX::ScratchImage& image, const PackInfo& info);
+
+    // after the last append, writes the index & points the header at it
+    HRESULT close();
+
+private:
+    struct KeyedEntry {
+        PackEntry   entry;
+        std::string key;
+    };
+
+    // zeros up to offset, from the end of what was written
+    void pad(uint64_t offset);
+
+    std::mutex              mutex;
+    std::ofstream           file;
+    uint64_t                end      = 0; // of what was written
+    uint32_t                sh_order = 2;
+    std::vector<KeyedEntry> entries;
+};
+
+class TiledDDSWriter;
+
+// Overlaps baking with saving:
+// device thread copies into a ring of staging textures, maps those whose copies are done on every enqueue without waiting,
+// and waits on the oldest one only when its slot comes up again
+// staging textures & host images come from ReadbackPools, the device's when given
+// writer threads compress & save from a bounded queue, so at most (staging + queue + writers) images are in flight
+class SavePipeline {
+public:
+    // sh outputs go to pack instead of their out_path when given, see --pack
+    SavePipeline(ID3D11Device* device, ID3D11DeviceContext* context, Profiler& profiler, uint32_t staging_count, uint32_t writer_count, uint32_t queue_capacity, PackWriter* pack = nullptr,
+                 ReadbackPools* pools = nullptr);
+    SavePipeline(const SavePipeline&)            = delete;
+    SavePipeline& operator=(const SavePipeline&) = delete;
+    ~SavePipeline() { finish(); }
+
+    // device thread only
+    // set is only for timings & the pack, width & height are the image size for kBlocksBC6H, ignored otherwise
+    void enqueue(ID3D11Texture2D* tex, std::string set, std::filesystem::path out_path, SaveFormat format, uint32_t width = 0, uint32_t height = 0, PackInfo pack_info = {});
+
+    // device thread only, a tile at texel x & y of tiled, whose blocks the writer threads write in place, see bakeTiled
+    // format is kCompressCpu or kBlocksBC6H, width & height are the tile size for the latter
+    void enqueueTile(ID3D11Texture2D* tex, std::string set, TiledDDSWriter* tiled, uint32_t x, uint32_t y, SaveFormat format, uint32_t width = 0, uint32_t height = 0);
+
+    // for images baked on the cpu, see bakeSetCpu
+    void enqueueImage(DirectX::ScratchImage image, std::string set, std::filesystem::path out_path, bool compressed, PackInfo pack_info = {});
+
+    // device thread only, drains all slots and waits for the writers
+    HRESULT finish();
+
+private:
+    // where the blocks of a tile go, writer is null for whole outputs
+    struct TileTarget {
+        TiledDDSWriter* writer = nullptr;
+        uint32_t        x      = 0;
+        uint32_t        y      = 0;
+    };
+
+    struct StagingSlot {
+        com_ptr<ID3D11Texture2D> tex  = nullptr;
+        D3D11_TEXTURE2D_DESC     desc = {}; // of the textures it reads back
+        std::string              set;
+        std::filesystem::path    out_path;
+        SaveFormat               format  = SaveFormat::kRaw;
+        uint32_t                 width     = 0;
+        uint32_t                 height    = 0;
+        PackInfo                 pack_info = {};
+        TileTarget               tile      = {};
+        bool                     pending   = false;
+    };
+
+    struct WriteJob {
+        DirectX::ScratchImage image;
+        std::string           set;
+        std::filesystem::path out_path;
+        bool                  compressed = false;
+        PackInfo              pack_info  = {};
+        TileTarget            tile       = {};
+        bool                  pooled     = false; // image goes back to pools->images once written
+    };
+
+    void enqueueSlot(ID3D11Texture2D* tex, std::string set, std::filesystem::path out_path, SaveFormat format, uint32_t width, uint32_t height, PackInfo pack_info, TileTarget tile);
+
+    // maps the slots whose copies are done, oldest first, without waiting for the gpu or for room in the queue
+    void poll();
+
+    // false while the copy into the slot runs, with D3D11_MAP_FLAG_DO_NOT_WAIT
+    bool readback(StagingSlot& slot, UINT map_flags);
+
+    bool queueFull();
+
+    // blocks while the queue is full
+    void push(WriteJob job);
+
+    void writerLoop();
+
+    HRESULT packImage(const WriteJob& job);
+
+    HRESULT writeTile(const WriteJob& job);
+
+    void recordError(HRESULT hr);
+
+    ID3D11Device*        device  = nullptr;
+    ID3D11DeviceContext* context = nullptr;
+    Profiler&            profiler;
+    PackWriter*          pack = nullptr;
+    ReadbackPools        own_pools; // without a device's
+    ReadbackPools*       pools = nullptr;
+
+    std::vector<StagingSlot> slots;
+    size_t                   next_slot = 0;
+    bool                     finished  = false;
+
+    std::mutex              mutex;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    std::deque<WriteJob>    queue;
+    size_t                  queue_capacity;
+    bool                    closing     = false;
+    HRESULT                 first_error = S_OK;
+
+    std::vector<std::jthread> writers; // last, so they are joined before anything else is destroyed
+};
+
+// a BC6H dds preallocated on disk, blocks of each tile get written in place
+// writes are under a lock, so the writer threads of a SavePipeline can write tiles in any order
+class TiledDDSWriter {
+public:
+    HRESULT open(const std::filesystem::path& path, uint32_t width, uint32_t height, uint32_t array_size);
+
+    // x & y in texels, multiples of 4
+    HRESULT writeBlocks(uint32_t slice, uint32_t x, uint32_t y, const uint8_t* blocks, size_t src_row_pitch, uint32_t blocks_x, uint32_t blocks_y);
+
+    HRESULT close();
+
+    // closes & deletes the output once open() created it, also after a failed close(), so a failed bake leaves no partial one behind
+    void discard();
+
+private:
+    static constexpr size_t BLOCK_SIZE = 16;
+
+    std::filesystem::path path;
+    std::mutex            mutex;
+    std::ofstream         file;
+    size_t        data_offset = 0;
+    size_t        row_pitch   = 0;
+    size_t        slice_pitch = 0;
+};
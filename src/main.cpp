@@ -1,239 +1,332 @@
-#include <array>
-#include <cassert>
-#include <cstdint>
-#include <expected>
+#include <deque>
 #include <filesystem>
-#include <ranges>
-#include <stdexcept>
+#include <map>
+#include <optional>
 #include <string>
 #include <string_view>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include <argparse/argparse.hpp>
-#include <spdlog/spdlog.h>
-#include <RE2/re2.h>
-
-#include <d3dcompiler.h>
-#include <d3d11.h>
-#include <d3d11_1.h>
-#include <DDSTextureLoader.h>
-#include <DirectXTex.h>
-#include <DirectXMath.h>
-#include <dxgi1_3.h>
-#include <winrt/base.h>
 
-using namespace std::literals;
-using winrt::com_ptr;
+#include <windows.h>
+#include <sddl.h>
 
-// took from https://github.com/Microsoft/DirectXTK/wiki/throwIfFailed
-namespace DX {
-// Helper class for COM exceptions
-class com_exception : public std::exception {
-public:
-    com_exception(HRESULT hr) :
-        result(hr) {}
+#include "lib/baker.h"
 
-    const char* what() const noexcept override
-    {
-        static char s_str[64] = {};
-        sprintf_s(s_str, "Failure with HRESULT of %08X",
-                  static_cast<unsigned int>(result));
-        return s_str;
+using namespace std::literals;
+
+namespace {
+// checks the input directory & creates the output ones
+HRESULT prepareDirs(const Arguments& args)
+{
+    if (!(std::filesystem::exists(args.in_dir) && std::filesystem::is_directory(args.in_dir))) {
+        spdlog::error("Invalid input directory: {}", args.in_dir.string());
+        return E_FAIL;
     }
 
-private:
-    HRESULT result;
-};
+    if (std::filesystem::exists(args.out_dir) && !std::filesystem::is_directory(args.out_dir)) {
+        spdlog::error("Output directory exists and is not a folder: {}", args.in_dir.string());
+        return E_FAIL;
+    }
 
-// Helper utility converts D3D API failures into exceptions.
-inline void ThrowIfFailed(HRESULT hr)
-{
-    if (FAILED(hr)) {
-        throw com_exception(hr);
+    if (std::filesystem::exists(args.validation_dir) && !std::filesystem::is_directory(args.validation_dir)) {
+        spdlog::error("Validation directory exists and is not a folder: {}", args.in_dir.string());
+        return E_FAIL;
     }
-}
-} // namespace DX
-
-// -----------------------------------------------------------------------------------------------------------------
-
-struct Arguments {
-    std::filesystem::path in_dir;
-    std::filesystem::path out_dir;
-    std::filesystem::path validation_dir;
-};
-
-struct ShTexture {
-    winrt::com_ptr<ID3D11Texture2D>    tex = nullptr;
-    com_ptr<ID3D11ShaderResourceView>  srv = nullptr;
-    com_ptr<ID3D11UnorderedAccessView> uav = nullptr;
-};
-
-struct InputTexture {
-    DirectX::XMFLOAT3                 light_direction = {1.F, 0.F, 0.F}; // note: unused for transmittance
-    uint32_t                          width           = 0;
-    uint32_t                          height          = 0;
-    com_ptr<ID3D11ShaderResourceView> srv             = nullptr;
-};
-
-struct InputTexSet {
-    uint32_t                  face; // see Common.hlsli
-    InputTexture              tr;
-    std::vector<InputTexture> colors;
-};
-
-struct BakeCBData {
-    DirectX::XMFLOAT3 light_dir;
-    float             weight;
-    uint32_t          face;
-    DirectX::XMFLOAT3 _pad;
-};
-static_assert(sizeof(BakeCBData) % 16 == 0);
-
-struct D3dObjs {
-    com_ptr<ID3D11Device1>        device  = nullptr;
-    com_ptr<ID3D11DeviceContext1> context = nullptr;
 
-    std::unordered_map<std::string, InputTexSet> tex_inputs;
-    ShTexture                                    tex_sh_coeffs = {};
-    com_ptr<ID3D11Buffer>                        common_buffer = nullptr;
-    com_ptr<ID3D11ComputeShader>                 bake_cs       = nullptr;
-    com_ptr<ID3D11ComputeShader>                 validation_cs = nullptr;
-};
+    if (!std::filesystem::exists(args.out_dir))
+        std::filesystem::create_directory(args.out_dir);
 
-namespace {
-uint32_t faceStrToUint(const std::string& str)
-{
-    static const std::map<std::string, uint32_t> KEYMAP = {
-        {"+x"s, 0},
-        {"-x"s, 1},
-        {"+y"s, 2},
-        {"-y"s, 3},
-        {"+z"s, 4},
-    };
-    return KEYMAP.at(str);
+    if (!args.validation_dir.empty() && !std::filesystem::exists(args.validation_dir))
+        std::filesystem::create_directory(args.validation_dir);
+    return S_OK;
 }
 
-ID3D11ComputeShader* compileShader(ID3D11Device* device, const std::filesystem::path& path, const char* entry_point)
+// finds, checks & bakes every set of args.in_dir on the devices, baked gets the keys of the sets whose outputs were saved
+HRESULT bakeInputs(std::deque<D3dObjs>& devices, const Arguments& args, Profiler& profiler, std::vector<std::string>& baked)
 {
-    spdlog::info("Compiling {} :{} ...", path.string(), entry_point);
+    std::unordered_map<std::string, InputTexSet> tex_inputs;
 
-    ID3DBlob* shader_blob   = nullptr;
-    ID3DBlob* shader_errors = nullptr;
+    // Read textures
+    BakeManifest                              manifest(args.out_dir / ".cloud-bakery-manifest");
+    std::unordered_map<std::string, uint64_t> set_hashes; // of sets to bake, see --incremental
+    {
+        const NameParser name_parser(args.tr_pattern, args.color_pattern);
+        if (!name_parser.ok()) {
+            spdlog::error("Invalid file name pattern");
+            return E_INVALIDARG;
+        }
 
-    if (!std::filesystem::exists(path)) {
-        spdlog::error("Failed to compile shader: {} does not exist", path.string());
-        return nullptr;
-    }
-    if (FAILED(D3DCompileFromFile(path.wstring().c_str(), nullptr, D3D_COMPILE_STANDARD_FILE_INCLUDE,
-                                  entry_point, "cs_5_0", D3DCOMPILE_ENABLE_STRICTNESS | D3DCOMPILE_OPTIMIZATION_LEVEL3, 0, &shader_blob, &shader_errors))) {
-        spdlog::error("Shader compilation failed:\n\n{}", (shader_errors != nullptr) ? static_cast<char*>(shader_errors->GetBufferPointer()) : "Unknown error");
-        return nullptr;
+        std::vector<std::filesystem::path> paths;
+        for (auto const& dir_entry : std::filesystem::directory_iterator{args.in_dir}) {
+            if (dir_entry.path().extension() != ".dds") {
+                spdlog::info("Skipping {}", dir_entry.path().filename().string());
+                continue;
+            }
+            paths.push_back(dir_entry.path());
+        }
+
+        // Drop sets whose output is up to date
+        if (args.incremental != Incremental::kOff) {
+            std::vector<uint64_t> file_hashes(paths.size());
+            parallelFor(paths.size(), args.io_threads, [&](size_t idx) {
+                const auto& path = paths[idx];
+                uint64_t    hash = hashBytes(path.filename().string());
+                if (args.incremental == Incremental::kContent) {
+                    file_hashes[idx] = hashFile(path, hash);
+                } else {
+                    std::error_code ec;
+                    const auto      size  = std::filesystem::file_size(path, ec);
+                    const auto      mtime = std::filesystem::last_write_time(path, ec).time_since_epoch().count();
+                    file_hashes[idx]      = hashBytes(std::format("|{}|{}", size, mtime), hash);
+                }
+            });
+
+            // the light directions are part of the file names, so they are covered above
+            const auto settings_hash = hashBytes(std::format("{:016x}|{}|{}|{}|{}|{}|{}|{}|{}|{}|{}", devices.front().shader_hash, args.batched, static_cast<int>(args.sh_format),
+                                                             args.gpu_compressor, args.tile_size, args.validation_dir.empty(), static_cast<int>(args.backend), args.group_faces, args.sh_order,
+                                                             args.tolerance, args.dedup));
+
+            // sorted by file name, so directory order does not matter
+            std::map<std::string, std::map<std::string, uint64_t>> set_files;
+            for (size_t i = 0; i < paths.size(); ++i) {
+                const auto filename = paths[i].filename().string();
+                if (auto parsed = name_parser.parse(filename))
+                    set_files[setKey(*parsed, args.group_faces)][filename] = file_hashes[i];
+            }
+            for (auto const& [key, files] : set_files) {
+                uint64_t hash = settings_hash;
+                for (auto const& [filename, file_hash] : files)
+                    hash = hashBytes(std::format("|{:016x}", file_hash), hash);
+                set_hashes[key] = hash;
+            }
+
+            std::unordered_set<std::string> up_to_date;
+            for (auto const& [key, hash] : set_hashes)
+                if (manifest.upToDate(key, hash) && std::filesystem::exists(args.out_dir / std::format("{}_sh.dds", key)))
+                    up_to_date.insert(key);
+            std::erase_if(paths, [&](auto const& path) {
+                const auto parsed = name_parser.parse(path.filename().string());
+                return parsed.has_value() && up_to_date.contains(setKey(*parsed, args.group_faces));
+            });
+            spdlog::info("Skipping {} up to date texture sets", up_to_date.size());
+        }
+
+        // Read headers on the worker pool, each worker owns the slots it picks
+        std::vector<std::optional<LoadedFile>> loaded_files(paths.size());
+        spdlog::info("Scanning {} files with {} threads ...", paths.size(), std::min<size_t>(args.io_threads, paths.size()));
+        parallelFor(paths.size(), args.io_threads, [&](size_t idx) {
+            const auto start  = Profiler::Clock::now();
+            loaded_files[idx] = loadInputFile(paths[idx], name_parser);
+            if (loaded_files[idx].has_value() && args.dedup)
+                loaded_files[idx]->tex.content_hash = hashFile(paths[idx]);
+            if (loaded_files[idx].has_value())
+                profiler.add(loaded_files[idx]->key, Stage::kLoad, Profiler::msSince(start));
+        });
+
+        // Only paths & metadata, pixels are read per set right before baking
+        for (auto& loaded : loaded_files) {
+            if (!loaded.has_value())
+                continue;
+
+            auto& tex     = loaded->tex;
+            auto& tex_set = tex_inputs[loaded->key];
+            if (loaded->is_tr)
+                tex_set.tr = tex;
+            else
+                tex_set.colors.push_back(tex);
+            tex_set.face       = faceStrToUint(loaded->face_str);
+            tex_set.identifier = identifierOf(loaded->key, loaded->face_str);
+
+            spdlog::info("Found {} ({} x {})", loaded->filename, tex.width, tex.height);
+        }
     }
 
-    ID3D11ComputeShader* reg_shader = nullptr;
-    if (FAILED(device->CreateComputeShader(shader_blob->GetBufferPointer(), shader_blob->GetBufferSize(), nullptr, &reg_shader))) {
-        spdlog::error("Failed to create compute shader");
-        return nullptr;
+    // Check sets, from metadata
+    std::vector<std::string> keys;
+    for (auto& [key, tex_set] : tex_inputs) {
+        if (tex_set.tr.path.empty()) {
+            spdlog::warn("Texture set \"{}\" has no transmittance texture ({}_tr.dds). Skipping the whole set", key, key);
+            continue;
+        }
+        if (tex_set.colors.empty()) {
+            spdlog::warn("Texture set \"{}\" has no color textures. Skipping the whole set", key);
+            continue;
+        }
+
+        const auto  width  = tex_set.tr.width;
+        const auto  height = tex_set.tr.height;
+        const auto& first  = tex_set.colors.front();
+        if (std::ranges::any_of(tex_set.colors, [width, height](auto const& tex) { return (tex.width != width) || (tex.height != height); })) {
+            spdlog::warn("Texture set \"{}\" has more than two sizes. Skipping the whole set", key);
+            continue;
+        }
+        if (std::ranges::any_of(tex_set.colors, [&first](auto const& tex) { return tex.format != first.format; })) {
+            spdlog::warn("Texture set \"{}\" has color textures of different formats. Skipping the whole set", key);
+            continue;
+        }
+        if (args.dedup && !args.group_faces) {
+            if (const auto collapsed = dedupColors(tex_set.colors); collapsed > 0)
+                spdlog::info("Texture set \"{}\" has {} duplicate color textures, baking them once", key, collapsed);
+        }
+        keys.push_back(key);
     }
-    return reg_shader;
-}
+    std::ranges::sort(keys);
+    if (args.group_faces)
+        keys = groupFaces(tex_inputs, keys);
+    else if (args.dedup) // sets of the same tr in a row, so a device keeps it from one to the next
+        std::ranges::stable_sort(keys, {}, [&](const std::string& key) { return tex_inputs.at(key).tr.content_hash; });
+
+    // Process, one thread per device
+    SetQueue                              queue(keys);
+    std::vector<HRESULT>                  results(devices.size(), S_OK);
+    std::vector<std::vector<std::string>> baked_keys(devices.size()); // recorded in the manifest once all saves went through
+    PackWriter pack;
+    if (!args.pack_path.empty())
+        DX::ThrowIfFailed(pack.open(args.out_dir / args.pack_path, args.sh_order));
+    parallelFor(devices.size(), devices.size(), [&](size_t idx) {
+        // on a worker thread, where an exception would terminate the process, --serve included
+        try {
+            results[idx] = bakeOnDevice(devices[idx], args, profiler, tex_inputs, queue, baked_keys[idx], args.pack_path.empty() ? nullptr : &pack);
+        } catch (const DX::com_exception& err) {
+            spdlog::error("{}{}", devices[idx].label, err.what());
+            results[idx] = err.get_result();
+        } catch (const std::exception& err) {
+            spdlog::error("{}{}", devices[idx].label, err.what());
+            results[idx] = E_FAIL;
+        }
+    });
+    if (!args.pack_path.empty())
+        DX::ThrowIfFailed(pack.close());
+
+    if (args.incremental != Incremental::kOff) {
+        for (size_t i = 0; i < devices.size(); ++i)
+            for (auto const& key : baked_keys[i])
+                manifest.set(key, set_hashes[key]);
+        DX::ThrowIfFailed(manifest.save());
+    }
+    for (auto hr : results)
+        DX::ThrowIfFailed(hr);
 
-template <bool is_sh>
-ShTexture initTex(ID3D11Device* device, uint32_t width, uint32_t height)
-{
-    ShTexture retval;
-
-    D3D11_TEXTURE2D_DESC tex_desc = {
-        .Width          = width,
-        .Height         = height,
-        .MipLevels      = 1,
-        .ArraySize      = is_sh ? 3 : 1,
-        .Format         = is_sh ? DXGI_FORMAT_R32G32B32A32_FLOAT : DXGI_FORMAT_R32_FLOAT,
-        .SampleDesc     = {.Count = 1, .Quality = 0},
-        .Usage          = D3D11_USAGE_DEFAULT,
-        .BindFlags      = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS,
-        .CPUAccessFlags = 0,
-        .MiscFlags      = 0,
-    };
-
-    D3D11_SHADER_RESOURCE_VIEW_DESC srv_desc = {
-        .Format        = tex_desc.Format,
-        .ViewDimension = is_sh ? D3D11_SRV_DIMENSION_TEXTURE2DARRAY : D3D11_SRV_DIMENSION_TEXTURE2D,
-    };
-    if constexpr (is_sh)
-        srv_desc.Texture2DArray = {.MostDetailedMip = 0, .MipLevels = 1, .FirstArraySlice = 0, .ArraySize = 3};
-    else
-        srv_desc.Texture2D = {.MostDetailedMip = 0, .MipLevels = 1};
-
-    D3D11_UNORDERED_ACCESS_VIEW_DESC uav_desc = {
-        .Format        = tex_desc.Format,
-        .ViewDimension = is_sh ? D3D11_UAV_DIMENSION_TEXTURE2DARRAY : D3D11_UAV_DIMENSION_TEXTURE2D,
-        .Texture2D     = {.MipSlice = 0},
-    };
-    if constexpr (is_sh)
-        uav_desc.Texture2DArray = {.MipSlice = 0, .FirstArraySlice = 0, .ArraySize = 3};
-    else
-        uav_desc.Texture2D = {.MipSlice = 0};
-
-    DX::ThrowIfFailed(device->CreateTexture2D(&tex_desc, nullptr, retval.tex.put()));
-    DX::ThrowIfFailed(device->CreateShaderResourceView(retval.tex.get(), &srv_desc, retval.srv.put()));
-    DX::ThrowIfFailed(device->CreateUnorderedAccessView(retval.tex.get(), &uav_desc, retval.uav.put()));
-
-    return retval;
+    for (auto& device_keys : baked_keys)
+        std::ranges::move(device_keys, std::back_inserter(baked));
+    return S_OK;
 }
 
-HRESULT saveTextureToDDS(ID3D11Device* device, ID3D11DeviceContext* context, ID3D11Texture2D* tex, const std::filesystem::path& out_path, bool compressed)
+// one job of --serve, answered with a "done\t(key)" line per baked set & a final "ok" or "failed\t(reason)"
+// timed on its own, reported after the job with --profile & dumped to --profile-out, which the next job overwrites
+std::string serveJob(std::deque<D3dObjs>& devices, const Arguments& server_args, std::string_view line)
 {
-    // Capture texture into a ScratchImage
-    DirectX::ScratchImage image;
-    HRESULT               hr = DirectX::CaptureTexture(device, context, tex, image);
-    if (FAILED(hr)) {
-        spdlog::error("Failed to capture texture {}\n");
-        return hr;
-    }
-
-    // Compress to BC6H format
-    DirectX::ScratchImage compressed_image;
-    if (compressed) {
-        hr = DirectX::Compress(
-            image.GetImages(),
-            image.GetImageCount(),
-            image.GetMetadata(),
-            DXGI_FORMAT_BC6H_SF16, // BC6H format
-            DirectX::TEX_COMPRESS_DEFAULT,
-            1.0F,
-            compressed_image);
-
-        if (FAILED(hr)) {
-            spdlog::error("Failed to compress texture to BC6H");
-            return hr;
+    const auto tab = line.find('\t');
+    if (tab == std::string_view::npos)
+        return "failed\texpected \"(input dir)\\t(output dir)\"\n";
+
+    // the device & shader options are fixed by the server, only the directories change
+    auto args    = server_args;
+    args.in_dir  = line.substr(0, tab);
+    args.out_dir = line.substr(tab + 1);
+    spdlog::info("Job \"{}\" to \"{}\"", args.in_dir.string(), args.out_dir.string());
+
+    // the directories come from the client, std::filesystem throws on invalid ones
+    Profiler                 profiler;
+    std::vector<std::string> baked;
+    HRESULT                  hr = S_OK;
+    try {
+        hr = prepareDirs(args);
+        if (SUCCEEDED(hr))
+            hr = bakeInputs(devices, args, profiler, baked);
+        if (args.profile) {
+            profiler.report();
+            if (!args.profile_out.empty())
+                DX::ThrowIfFailed(profiler.dump(args.profile_out));
         }
+    } catch (const std::exception& err) {
+        spdlog::error("Job failed: {}", err.what());
+        return std::format("failed\t{}\n", err.what());
     }
 
-    auto& target_image = compressed ? compressed_image : image;
+    std::string response;
+    for (auto const& key : baked)
+        response += std::format("done\t{}\n", key);
+    response += SUCCEEDED(hr) ? "ok\n"s : std::format("failed\tHRESULT {:08X}\n", static_cast<unsigned int>(hr));
+    return response;
+}
+
+// --serve, keeps the devices & compiled shaders of this run and bakes the jobs sent over \\.\pipe\(name), one client at a time
+// a client writes one job per line & reads the answers back in order, the server stops on "quit"
+// jobs name any directory & are written as the server's user, so only local clients of that user may connect
+HRESULT serve(std::deque<D3dObjs>& devices, const Arguments& args)
+{
+    constexpr DWORD PIPE_BUFFER_SIZE = 4096;
+    constexpr auto  PIPE_SDDL        = L"D:P(A;;GA;;;SY)(A;;GA;;;OW)"; // system & the owner, the server's user, nobody else
 
-    // Save to DDS file
-    hr = DirectX::SaveToDDSFile(
-        target_image.GetImages(),
-        target_image.GetImageCount(),
-        target_image.GetMetadata(),
-        DirectX::DDS_FLAGS_NONE,
-        out_path.wstring().c_str());
+    const auto pipe_name = std::format("\\\\.\\pipe\\{}", args.serve_pipe);
+    spdlog::info("Serving bake jobs on {}", pipe_name);
 
-    if (FAILED(hr)) {
-        spdlog::error("Failed to save DDS file");
-        return hr;
+    PSECURITY_DESCRIPTOR security_descriptor = nullptr;
+    if (!ConvertStringSecurityDescriptorToSecurityDescriptorW(PIPE_SDDL, SDDL_REVISION_1, &security_descriptor, nullptr)) {
+        spdlog::error("Failed to create the security descriptor of {}", pipe_name);
+        return HRESULT_FROM_WIN32(GetLastError());
     }
+    const std::unique_ptr<void, decltype(&LocalFree)> security_descriptor_owner(security_descriptor, &LocalFree);
+    SECURITY_ATTRIBUTES                                security = {.nLength = sizeof(SECURITY_ATTRIBUTES), .lpSecurityDescriptor = security_descriptor, .bInheritHandle = FALSE};
+
+    for (bool quit = false; !quit;) {
+        // the first instance, so no other process can hold the name before us
+        winrt::file_handle pipe{CreateNamedPipeW(std::filesystem::path(pipe_name).wstring().c_str(), PIPE_ACCESS_DUPLEX | FILE_FLAG_FIRST_PIPE_INSTANCE,
+                                                 PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS, 1, PIPE_BUFFER_SIZE, PIPE_BUFFER_SIZE, 0, &security)};
+        if (!pipe) {
+            spdlog::error("Failed to create {}", pipe_name);
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+        if (!ConnectNamedPipe(pipe.get(), nullptr) && GetLastError() != ERROR_PIPE_CONNECTED) {
+            spdlog::warn("Failed to connect a client");
+            continue;
+        }
+        spdlog::info("Client connected");
+
+        std::array<char, PIPE_BUFFER_SIZE> buffer;
+        std::string                        pending; // up to the next newline
+        DWORD                              read = 0;
+        while (!quit && ReadFile(pipe.get(), buffer.data(), PIPE_BUFFER_SIZE, &read, nullptr)) {
+            pending.append(buffer.data(), read);
+            for (auto end = pending.find('\n'); !quit && end != std::string::npos; end = pending.find('\n')) {
+                auto line = pending.substr(0, end);
+                pending.erase(0, end + 1);
+                if (line.ends_with('\r'))
+                    line.pop_back();
+                if (line.empty())
+                    continue;
+                if (line == "quit") {
+                    quit = true;
+                    continue;
+                }
+
+                // answered once baked, the client reads it while the next job bakes
+                const auto response = serveJob(devices, args, line);
+                DWORD      written  = 0;
+                if (!WriteFile(pipe.get(), response.data(), static_cast<DWORD>(response.size()), &written, nullptr))
+                    spdlog::warn("Failed to answer the client");
+            }
+        }
+        if (!quit && GetLastError() != ERROR_BROKEN_PIPE)
+            spdlog::warn("Failed to read from the client");
+        spdlog::info("Client disconnected");
 
+        FlushFileBuffers(pipe.get());
+        DisconnectNamedPipe(pipe.get());
+    }
     return S_OK;
 }
 } // namespace
 
-
 int main(int argc, char* argv[])
 {
-    Arguments args;
-    D3dObjs   d3d{};
+    Arguments           args;
+    std::deque<D3dObjs> devices; // a single one without a device for --backend cpu
+    Profiler            profiler;
 
     // Arg parse
     {
@@ -250,6 +343,114 @@ int main(int argc, char* argv[])
             .help("Output directory of reconstructed images.\n"
                   "Specifying this to generate a reconstructed image of the first image of the set")
             .default_value(std::string{});
+        program.add_argument("--validate")
+            .help("Reconstruct every light direction of each set from its coefficients and log the rmse & max error against the inputs.\n"
+                  "Only the metrics are read back, use --validation-dir for images.")
+            .flag();
+        program.add_argument("-b", "--batched")
+            .help("Bake all light directions of a set in a single dispatch.")
+            .flag();
+        program.add_argument("--io-threads")
+            .help("Number of worker threads reading and parsing input files.")
+            .default_value(static_cast<int>(std::max(1U, std::thread::hardware_concurrency())))
+            .scan<'i', int>();
+        program.add_argument("--mmap")
+            .help("Map input dds files instead of reading them, textures are created straight from the mapped pages.\n"
+                  "Files in legacy layouts that need converting are decoded from the mapping as before.")
+            .flag();
+        program.add_argument("--staging-count")
+            .help("Number of staging textures that readbacks rotate through, 2 or more lets baking overlap saving.")
+            .default_value(3)
+            .scan<'i', int>();
+        program.add_argument("--writer-threads")
+            .help("Number of threads compressing and writing output files.")
+            .default_value(2)
+            .scan<'i', int>();
+        program.add_argument("--max-pending-writes")
+            .help("Maximum number of read back images waiting for a writer thread. Caps host memory in flight.")
+            .default_value(4)
+            .scan<'i', int>();
+        program.add_argument("--compressor")
+            .help("Where the output gets compressed to BC6H, \"cpu\" (DirectXTex) or \"gpu\" (BC6H.cs.hlsl, faster, lower quality).")
+            .default_value("cpu"s);
+        program.add_argument("--sh-format")
+            .help("Storage of the SH coefficients while baking, \"f32\" or \"f16\" (half the memory & bandwidth, requires --batched).")
+            .default_value("f32"s);
+        program.add_argument("--sh-order")
+            .help("Order of the baked SH, 1 (4 coefficients in 2 slices) or 2 (9 coefficients in 3 slices).")
+            .default_value(2)
+            .scan<'i', int>();
+        program.add_argument("--tile-size")
+            .help("Bake each face in tiles of this size (multiple of 4), streaming inputs and output from/to disk.\n"
+                  "Bounds memory regardless of texture size. Inputs must be uncompressed, validation is not supported.")
+            .default_value(0)
+            .scan<'i', int>();
+        program.add_argument("--tolerance")
+            .help("Bake light directions progressively, in an order spreading them evenly over the sphere, doubling them until the held out\n"
+                  "one in eight reconstructs within this relative rmse, e.g. 0.02, and weighting by those used. 0 bakes every direction.\n"
+                  "Requires --batched & --backend gpu, and is not supported with --tile-size or --group-faces.")
+            .default_value(0.F)
+            .scan<'g', float>();
+        program.add_argument("--shader-dir")
+            .help("Compile shaders from the sources in this directory instead of using the embedded bytecode.\n"
+                  "Compiled blobs are cached in the temp directory until the sources change.")
+            .default_value(std::string{});
+        program.add_argument("--concurrent-sets")
+            .help("Number of texture sets baked at once, interleaving their dispatches before any read back.\n"
+                  "0 picks as many as fit in free video memory. Ignored with --tile-size.")
+            .default_value(1)
+            .scan<'i', int>();
+        program.add_argument("--pack")
+            .help("Append the sh output of every set to this single file in the output directory instead of one dds per set.\n"
+                  "Its index holds each set's offset, size, faces & sh order, sorted by key. Ignored with --tile-size.")
+            .default_value(std::string{});
+        program.add_argument("--incremental")
+            .help("Skip sets whose output is up to date, tracked in a manifest in the output directory.\n"
+                  "\"mtime\" compares input names, sizes & modification times, \"content\" hashes the whole inputs, \"off\" rebakes everything.")
+            .default_value("off"s);
+        program.add_argument("--backend")
+            .help("Bake on the \"gpu\" through d3d11, on the \"cpu\" for machines without a gpu, or through \"d3d12\".\n"
+                  "d3d12 bakes on a compute queue while earlier sets are read back on a copy queue, --staging-count sets are in flight.\n"
+                  "It has no gpu compressor, --validate, --phase-lut, --tile-size or gpu timings, and ignores --concurrent-sets.")
+            .default_value("gpu"s);
+        program.add_argument("--cpu-threads")
+            .help("Number of threads baking with --backend cpu, 0 uses all cores.")
+            .default_value(0)
+            .scan<'i', int>();
+        program.add_argument("--gpus")
+            .help("Adapters to bake on, \"all\" or comma separated indices like \"0,2\", each taking the next set whenever it is ready.\n"
+                  "Defaults to the default adapter.")
+            .default_value(std::string{});
+        program.add_argument("--phase-lut")
+            .help("Read view directions & the phase function from lookup tables built once, instead of evaluating them per texel & light.\n"
+                  "With --validation-dir, also writes the relative error of the tabulated phase as *_lut_err.dds.")
+            .flag();
+        program.add_argument("--group-faces")
+            .help("Bake all faces of an identifier in a single dispatch into one \"(identifier)_sh.dds\", requires --batched.\n"
+                  "Slices 3i to 3i+2 hold the i-th face found, in +x, -x, +y, -y, +z order. Faces must share size, formats & light directions.")
+            .flag();
+        program.add_argument("--dedup")
+            .help("Hash input textures while scanning. Colors of a set with the same light direction & content are baked once, weighted by\n"
+                  "how many there are, and with --backend gpu consecutive sets of the same transmittance share one texture.\n"
+                  "The colors of --group-faces sets are not collapsed.")
+            .flag();
+        program.add_argument("--tr-pattern")
+            .help("RE2 pattern of transmittance file names, capturing the identifier & the face.")
+            .default_value(std::string{});
+        program.add_argument("--color-pattern")
+            .help("RE2 pattern of color file names, capturing the identifier, the face & the x, y, z of the light direction.")
+            .default_value(std::string{});
+        program.add_argument("--profile")
+            .help("Time each stage with cpu timers & gpu timestamp queries, and print a summary per set at exit.")
+            .flag();
+        program.add_argument("--profile-out")
+            .help("Also write the timings to this file, as csv if it ends in .csv and json otherwise. Implies --profile.")
+            .default_value(std::string{});
+        program.add_argument("--serve")
+            .help("Keep the devices & compiled shaders alive and bake jobs sent over the named pipe \\\\.\\pipe\\(name) instead.\n"
+                  "A job is a line \"(input dir)\\t(output dir)\", baked with the other options given here, \"quit\" stops the server.\n"
+                  "Each job is answered with a \"done\\t(key)\" line per baked set, then \"ok\" or \"failed\\t(reason)\".")
+            .default_value(std::string{});
 
         try {
             program.parse_args(argc, argv);
@@ -263,241 +464,219 @@ int main(int argc, char* argv[])
         args.in_dir         = program.get("-i");
         args.out_dir        = program.get("-o");
         args.validation_dir = program.get("-v");
-
-        if (!(std::filesystem::exists(args.in_dir) && std::filesystem::is_directory(args.in_dir))) {
-            spdlog::error("Invalid input directory: {}", args.in_dir.string());
-            return E_FAIL;
+        args.validate       = program.get<bool>("--validate");
+        args.batched        = program.get<bool>("-b");
+        args.io_threads     = static_cast<uint32_t>(std::max(1, program.get<int>("--io-threads")));
+        args.mmap           = program.get<bool>("--mmap");
+
+        args.staging_count      = static_cast<uint32_t>(std::max(1, program.get<int>("--staging-count")));
+        args.writer_threads     = static_cast<uint32_t>(std::max(1, program.get<int>("--writer-threads")));
+        args.max_pending_writes = static_cast<uint32_t>(std::max(1, program.get<int>("--max-pending-writes")));
+
+        const auto backend = program.get("--backend");
+        if (backend != "gpu" && backend != "cpu" && backend != "d3d12") {
+            spdlog::error("Invalid backend: {}", backend);
+            return E_INVALIDARG;
         }
-
-        if (std::filesystem::exists(args.out_dir) && !std::filesystem::is_directory(args.out_dir)) {
-            spdlog::error("Output directory exists and is not a folder: {}", args.in_dir.string());
-            return E_FAIL;
+        args.backend     = (backend == "cpu") ? Backend::kCpu : ((backend == "d3d12") ? Backend::kD3d12 : Backend::kGpu);
+        args.cpu_threads = static_cast<uint32_t>(std::max(0, program.get<int>("--cpu-threads")));
+        if (args.cpu_threads == 0)
+            args.cpu_threads = std::max(1U, std::thread::hardware_concurrency());
+
+        const auto compressor = program.get("--compressor");
+        if (compressor != "cpu" && compressor != "gpu") {
+            spdlog::error("Invalid compressor: {}", compressor);
+            return E_INVALIDARG;
         }
-
-        if (std::filesystem::exists(args.validation_dir) && !std::filesystem::is_directory(args.validation_dir)) {
-            spdlog::error("Validation directory exists and is not a folder: {}", args.in_dir.string());
-            return E_FAIL;
+        if (compressor == "gpu" && args.backend != Backend::kGpu) {
+            spdlog::error("--compressor gpu requires --backend gpu");
+            return E_INVALIDARG;
         }
+        args.gpu_compressor = compressor == "gpu";
 
-        if (!std::filesystem::exists(args.out_dir))
-            std::filesystem::create_directory(args.out_dir);
-
-        if (!args.validation_dir.empty() && !std::filesystem::exists(args.validation_dir))
-            std::filesystem::create_directory(args.validation_dir);
-    }
-
-    // Initialize d3d device & context
-    {
-        ID3D11Device*        base_device      = nullptr;
-        ID3D11DeviceContext* base_device_ctxt = nullptr;
-        D3D_FEATURE_LEVEL    feat_lvls[]      = {D3D_FEATURE_LEVEL_11_0};
-        UINT                 creation_flags   = D3D11_CREATE_DEVICE_BGRA_SUPPORT;
-
-        HRESULT hr = D3D11CreateDevice(nullptr, D3D_DRIVER_TYPE_HARDWARE,
-                                       nullptr, creation_flags,
-                                       feat_lvls, ARRAYSIZE(feat_lvls),
-                                       D3D11_SDK_VERSION, &base_device,
-                                       nullptr, &base_device_ctxt);
-        if (FAILED(hr)) {
-            spdlog::error("Failed to create ID3D11Device");
-            return hr;
+        const auto sh_format = program.get("--sh-format");
+        if (sh_format != "f32" && sh_format != "f16") {
+            spdlog::error("Invalid SH format: {}", sh_format);
+            return E_INVALIDARG;
         }
-
-        // Get 1.1 interface of D3D11 Device and Context
-        hr = base_device->QueryInterface(IID_PPV_ARGS(&d3d.device));
-        if (FAILED(hr)) {
-            spdlog::error("Failed to create ID3D11Device1");
-            return hr;
+        if (sh_format == "f16" && !args.batched && args.backend != Backend::kCpu) {
+            spdlog::error("--sh-format f16 requires --batched");
+            return E_INVALIDARG;
         }
-        base_device->Release();
+        args.sh_format = (sh_format == "f16") ? DXGI_FORMAT_R16G16B16A16_FLOAT : DXGI_FORMAT_R32G32B32A32_FLOAT;
 
-        hr = base_device_ctxt->QueryInterface(IID_PPV_ARGS(&d3d.context));
-        if (FAILED(hr)) {
-            spdlog::error("Failed to create ID3D11DeviceContext1");
-            return hr;
+        const auto sh_order = program.get<int>("--sh-order");
+        if (sh_order != 1 && sh_order != 2) {
+            spdlog::error("Invalid SH order: {}", sh_order);
+            return E_INVALIDARG;
         }
-        base_device_ctxt->Release();
-    }
-
-    // Read textures
-    {
-        const RE2 tr_file_re{R"(^(.*)_([+-][xyz])_tr.dds$)"};
-        const RE2 color_file_re{R"(^(.*)_([+-][xyz])_([+-]?(?:\d*\.\d+|\d+\.\d*|\d+))_([+-]?(?:\d*\.\d+|\d+\.\d*|\d+))_([+-]?(?:\d*\.\d+|\d+\.\d*|\d+)).dds$)"};
-        for (auto const& dir_entry : std::filesystem::directory_iterator{args.in_dir}) {
-            auto filename_path = dir_entry.path().filename();
-            auto filename      = filename_path.string();
-            if (filename_path.extension() != ".dds") {
-                spdlog::info("Skipping {}", filename);
-                continue;
-            }
-            spdlog::info("Reading {} ...", filename);
-
-            std::string  identifier;
-            std::string  face_str;
-            InputTexture tex;
+        args.sh_order = static_cast<uint32_t>(sh_order);
 
-            bool is_tr = RE2::FullMatch(filename, tr_file_re, &identifier, &face_str);
-            if (!is_tr && !RE2::FullMatch(filename, color_file_re, &identifier, &face_str, &tex.light_direction.x, &tex.light_direction.y, &tex.light_direction.z)) {
-                spdlog::warn("\t{} does not match the naming pattern.", filename);
-                continue;
-            }
-
-            ID3D11Resource* temp_rsrc = nullptr;
-            auto            hr        = DirectX::CreateDDSTextureFromFile(d3d.device.get(), dir_entry.path().wstring().c_str(), &temp_rsrc, tex.srv.put());
-            if (FAILED(hr)) {
-                spdlog::warn("\tFailed to read texture from {}", filename);
-                continue;
-            }
-
-            ID3D11Texture2D* temp_tex = nullptr;
-            hr                        = temp_rsrc->QueryInterface(IID_PPV_ARGS(&temp_tex));
-            if (FAILED(hr)) {
-                spdlog::warn("\t{} is not a 2d texture", filename);
-                continue;
-            }
-
-            D3D11_TEXTURE2D_DESC tex_desc;
-            temp_tex->GetDesc(&tex_desc);
-            tex.width  = tex_desc.Width;
-            tex.height = tex_desc.Height;
-
-            std::string key = std::format("{}_{}", identifier, face_str);
-            if (!d3d.tex_inputs.contains(key))
-                d3d.tex_inputs[key] = {};
-
-            if (is_tr) {
-                d3d.tex_inputs[key].tr = tex;
-            } else {
-                DirectX::XMStoreFloat3(&tex.light_direction, DirectX::XMVector3Normalize(DirectX::XMLoadFloat3(&tex.light_direction)));
-                d3d.tex_inputs[key].colors.push_back(tex);
-            }
-            d3d.tex_inputs[key].face = faceStrToUint(face_str);
-
-            spdlog::info("\tLoaded {} ({} x {})", filename, tex.width, tex.height);
+        args.tile_size = static_cast<uint32_t>(std::max(0, program.get<int>("--tile-size")));
+        if (args.tile_size % 4 != 0) {
+            spdlog::error("Tile size must be a multiple of 4");
+            return E_INVALIDARG;
         }
-    }
-
-    // Initialize other d3d structures
-    {
-        D3D11_BUFFER_DESC desc = {
-            .ByteWidth      = (sizeof(BakeCBData) + (64 - 1)) & ~(64 - 1),
-            .Usage          = D3D11_USAGE_DEFAULT,
-            .BindFlags      = D3D11_BIND_CONSTANT_BUFFER,
-            .CPUAccessFlags = 0,
-        };
-        auto hr = d3d.device->CreateBuffer(&desc, nullptr, d3d.common_buffer.put());
-        if (FAILED(hr)) {
-            spdlog::warn("Failed to create constant buffer");
-            return hr;
+        if (args.tile_size > 0 && args.backend != Backend::kGpu) {
+            spdlog::warn("--tile-size is only supported with --backend gpu, ignoring it");
+            args.tile_size = 0;
+        }
+        if (args.tile_size > 0 && !args.validation_dir.empty()) {
+            spdlog::warn("Validation is not supported with --tile-size, ignoring --validation-dir");
+            args.validation_dir.clear();
+        }
+        if (args.tile_size > 0 && args.validate) {
+            spdlog::warn("Validation is not supported with --tile-size, ignoring --validate");
+            args.validate = false;
+        }
+        if (args.backend == Backend::kD3d12 && args.validate) {
+            spdlog::warn("--validate is not supported with --backend d3d12, ignoring it");
+            args.validate = false;
         }
-    }
-
-    {
-        auto* base_cs = compileShader(d3d.device.get(), "./shaders/Bake.cs.hlsl", "main");
-        if (base_cs == nullptr)
-            return E_FAIL;
-        d3d.bake_cs.attach(base_cs);
-    }
-
-    {
-        auto* base_cs = compileShader(d3d.device.get(), "./shaders/Validation.cs.hlsl", "main");
-        if (base_cs == nullptr)
-            return E_FAIL;
-        d3d.validation_cs.attach(base_cs);
-    }
-
-    // Common setup
-    {
-        auto* cb = d3d.common_buffer.get();
-        d3d.context->CSSetConstantBuffers(0, 1, &cb);
-        d3d.context->CSSetShader(d3d.bake_cs.get(), nullptr, 0);
-    }
 
-    // Process
-    for (auto const& [key, tex_set] : d3d.tex_inputs) {
-        spdlog::info("Processing texture set \"{}\" ...", key);
+        args.concurrent_sets = static_cast<uint32_t>(std::max(0, program.get<int>("--concurrent-sets")));
 
-        if (tex_set.tr.srv == nullptr) {
-            spdlog::warn("\tTexture set \"{}\" has no transmittance texture ({}_tr.dds). Skipping the whole set", key, key);
-            continue;
+        args.tolerance = program.get<float>("--tolerance");
+        if (args.tolerance < 0) {
+            spdlog::error("Tolerance must not be negative");
+            return E_INVALIDARG;
+        }
+        if (args.tolerance > 0 && (args.backend != Backend::kGpu || args.tile_size > 0)) {
+            spdlog::warn("--tolerance is only supported with --backend gpu & without --tile-size, ignoring it");
+            args.tolerance = 0;
+        }
+        if (args.tolerance > 0 && !args.batched) {
+            spdlog::error("--tolerance requires --batched");
+            return E_INVALIDARG;
         }
 
-        const auto width  = tex_set.tr.width;
-        const auto height = tex_set.tr.height;
-
-        // Checking equal dimensions
-        if (std::ranges::any_of(tex_set.colors, [width, height](auto const& tex) { return (tex.width != width) || (tex.height != height); })) {
-            spdlog::warn("\tTexture set \"{}\" has more than two sizes. Skipping the whole set", key);
-            continue;
+        const auto incremental = program.get("--incremental");
+        if (incremental != "off" && incremental != "mtime" && incremental != "content") {
+            spdlog::error("Invalid incremental mode: {}", incremental);
+            return E_INVALIDARG;
         }
+        args.incremental = (incremental == "content") ? Incremental::kContent : ((incremental == "mtime") ? Incremental::kMtime : Incremental::kOff);
 
-        d3d.tex_sh_coeffs = initTex<true>(d3d.device.get(), width, height);
-        float values[4]   = {0, 0, 0, 0};
-        d3d.context->ClearUnorderedAccessViewFloat(d3d.tex_sh_coeffs.uav.get(), values);
+        args.pack_path = program.get("--pack");
+        if (!args.pack_path.empty() && args.tile_size > 0) {
+            spdlog::warn("--pack is not supported with --tile-size, ignoring it");
+            args.pack_path.clear();
+        }
+        if (!args.pack_path.empty() && args.incremental != Incremental::kOff) {
+            spdlog::warn("--incremental is not supported with --pack, which is rewritten on every run, ignoring it");
+            args.incremental = Incremental::kOff;
+        }
 
-        d3d.context->CSSetShader(d3d.bake_cs.get(), nullptr, 0);
+        args.gpus      = program.get("--gpus");
+        args.phase_lut = program.get<bool>("--phase-lut");
+        if (args.phase_lut && args.backend != Backend::kGpu) {
+            spdlog::warn("--phase-lut is only used by --backend gpu, ignoring it");
+            args.phase_lut = false;
+        }
 
-        BakeCBData cb_data{
-            .weight = 1.F / static_cast<float>(tex_set.colors.size()),
-            .face   = tex_set.face,
-        };
+        args.group_faces = program.get<bool>("--group-faces");
+        if (args.group_faces && (args.backend == Backend::kCpu || args.tile_size > 0)) {
+            spdlog::warn("--group-faces is not supported with --backend cpu or --tile-size, ignoring it");
+            args.group_faces = false;
+        }
+        if (args.group_faces && !args.batched) {
+            spdlog::error("--group-faces requires --batched");
+            return E_INVALIDARG;
+        }
+        if (args.group_faces && args.phase_lut) {
+            spdlog::warn("--phase-lut is not supported with --group-faces, ignoring it");
+            args.phase_lut = false;
+        }
+        if (args.group_faces && (args.validate || !args.validation_dir.empty())) {
+            spdlog::warn("Validation is not supported with --group-faces, ignoring --validate & --validation-dir");
+            args.validate = false;
+            args.validation_dir.clear();
+        }
+        if (args.group_faces && args.tolerance > 0) {
+            spdlog::warn("--tolerance is not supported with --group-faces, ignoring it");
+            args.tolerance = 0;
+        }
 
-        // Dispatch
-        for (auto const& entry : tex_set.colors) {
-            cb_data.light_dir = entry.light_direction,
-            d3d.context->UpdateSubresource(d3d.common_buffer.get(), 0, nullptr, &cb_data, 0, 0);
+        args.dedup = program.get<bool>("--dedup");
 
-            auto srvs = std::array{
-                entry.srv.get(),
-                tex_set.tr.srv.get(),
-            };
-            d3d.context->CSSetShaderResources(0, srvs.size(), srvs.data());
+        args.tr_pattern    = program.get("--tr-pattern");
+        args.color_pattern = program.get("--color-pattern");
 
-            auto uavs = std::array{d3d.tex_sh_coeffs.uav.get()};
-            d3d.context->CSSetUnorderedAccessViews(0, uavs.size(), uavs.data(), nullptr);
+        args.profile_out = program.get("--profile-out");
+        args.profile     = program.get<bool>("--profile") || !args.profile_out.empty();
 
-            d3d.context->Dispatch((width + 7) / 8, (height + 7) / 8, 1);
+        args.serve_pipe = program.get("--serve");
 
-            // clear
-            srvs.fill(nullptr);
-            d3d.context->CSSetShaderResources(0, srvs.size(), srvs.data());
-            uavs.fill(nullptr);
-            d3d.context->CSSetUnorderedAccessViews(0, uavs.size(), uavs.data(), nullptr);
+        args.shader_dir = program.get("--shader-dir");
+        if (!args.shader_dir.empty() && !std::filesystem::is_directory(args.shader_dir)) {
+            spdlog::error("Invalid shader directory: {}", args.shader_dir.string());
+            return E_INVALIDARG;
         }
 
-        // Save textures
-        DX::ThrowIfFailed(saveTextureToDDS(d3d.device.get(), d3d.context.get(), d3d.tex_sh_coeffs.tex.get(),
-                                           args.out_dir / std::format("{}_sh.dds", key), true));
+        // with --serve, every job brings its own
+        if (args.serve_pipe.empty()) {
+            HRESULT hr = prepareDirs(args);
+            if (FAILED(hr))
+                return hr;
+        }
+    }
 
-        // Validation
-        if (!args.validation_dir.empty()) {
-            auto  valid_tex = initTex<false>(d3d.device.get(), width, height);
-            auto* uav       = valid_tex.uav.get();
-            d3d.context->CSSetUnorderedAccessViews(0, 1, &uav, nullptr);
+    // Initialize d3d devices & contexts
+    if (args.backend != Backend::kCpu) {
+        std::vector<com_ptr<IDXGIAdapter1>> adapters = {nullptr}; // the default adapter
+        if (!args.gpus.empty()) {
+            HRESULT hr = selectAdapters(args.gpus, adapters);
+            if (FAILED(hr))
+                return hr;
+        }
 
-            auto srvs = std::array{
-                d3d.tex_sh_coeffs.srv.get(),
-                tex_set.tr.srv.get(),
-            };
-            d3d.context->CSSetShaderResources(0, srvs.size(), srvs.data());
+        for (size_t i = 0; i < adapters.size(); ++i) {
+            auto& d3d = devices.emplace_back();
+            // d3d12 devices get their pipelines right away, there is nothing else to set up
+            HRESULT hr = (args.backend == Backend::kD3d12) ? initDevice12(d3d, args, adapters[i].get()) : initDevice(d3d, adapters[i].get());
+            if (FAILED(hr))
+                return hr;
+            if (adapters.size() > 1)
+                d3d.label = std::format("[gpu {}] ", i);
+
+            if (args.profile && args.backend == Backend::kGpu)
+                d3d.gpu_timer.init(d3d.device.get(), d3d.context.get());
+        }
+    } else {
+        devices.emplace_back();
+    }
 
-            d3d.context->CSSetShader(d3d.validation_cs.get(), nullptr, 0);
-            d3d.context->Dispatch((width + 7) / 8, (height + 7) / 8, 1);
+    // Initialize other d3d structures & shaders, before reading so --incremental can hash the bytecode
+    // every device compiles its own, the bytecode is the same
+    if (args.backend == Backend::kGpu) {
+        for (auto& d3d : devices) {
+            const auto compile_start = Profiler::Clock::now();
 
-            // clear
-            uav = nullptr;
-            d3d.context->CSSetUnorderedAccessViews(0, 1, &uav, nullptr);
-            srvs.fill(nullptr);
-            d3d.context->CSSetShaderResources(0, srvs.size(), srvs.data());
+            HRESULT hr = initShaders(d3d, args);
+            if (FAILED(hr))
+                return hr;
 
-            // save
-            DX::ThrowIfFailed(saveTextureToDDS(d3d.device.get(), d3d.context.get(), valid_tex.tex.get(),
-                                               args.validation_dir / std::format("{}_{:.2f}_{:.2f}_{:.2f}_re.dds", key, cb_data.light_dir.x, cb_data.light_dir.y, cb_data.light_dir.z), false));
+            profiler.add("", Stage::kCompile, Profiler::msSince(compile_start));
         }
+    }
 
-        spdlog::info("\tDone");
+    if (!args.serve_pipe.empty()) {
+        HRESULT hr = serve(devices, args);
+        if (FAILED(hr))
+            return hr;
+    } else {
+        std::vector<std::string> baked;
+        HRESULT                  hr = bakeInputs(devices, args, profiler, baked);
+        if (FAILED(hr))
+            return hr;
     }
 
+    // with --serve only the compilation, each job reports & dumps its own
+    if (args.profile) {
+        profiler.report();
+        if (!args.profile_out.empty() && args.serve_pipe.empty())
+            DX::ThrowIfFailed(profiler.dump(args.profile_out));
+    }
 
     return S_OK;
 }
@@ -0,0 +1,139 @@
+// Fast BC6H_SF16 encoder for the baked SH coefficients, one thread per 4x4 block
+// Only mode 11 (single region, 10 bit endpoints, 4 bit indices) with oriented bounding box endpoints.
+// Blocks are written as R32G32B32A32_UINT and reinterpreted as BC6H on the host.
+// Ref: https://learn.microsoft.com/en-us/windows/win32/direct3d11/bc6h-format
+
+Texture2DArray<float3> TexSHCoeffs : register(t0);
+RWTexture2DArray<uint4> RWTexBlocks : register(u0);
+
+static const int WEIGHTS[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+static const int F16MAX = 0x7BFF;
+static const uint MODE_11 = 0x03;
+
+// half bits -> signed integer domain in which bc6h interpolates
+int3 toIntDomain(float3 v)
+{
+    uint3 h = f32tof16(v);
+    int3 mag = min(int3(h & 0x7FFF), F16MAX);
+    return (h & 0x8000) ? -mag : mag;
+}
+
+// 10 bit signed endpoint
+int3 quantize(int3 v)
+{
+    return sign(v) * ((abs(v) << 9) / (F16MAX + 1));
+}
+
+int3 unquantize(int3 q)
+{
+    int3 a = abs(q);
+    int3 unq = (a >= 511) ? 0x7FFF : ((a << 15) + 0x4000) >> 9;
+    return sign(q) * unq;
+}
+
+// what the decoder outputs for a given interpolated value
+int3 finishUnquantize(int3 c)
+{
+    return sign(c) * ((abs(c) * 31) >> 5);
+}
+
+uint closestIndex(int3 texel, int3 palette[16])
+{
+    uint index = 0;
+    float best_err = 3.402823466e+38;
+    for (uint j = 0; j < 16; ++j) {
+        float3 d = texel - palette[j];
+        float err = dot(d, d);
+        if (err < best_err) {
+            best_err = err;
+            index = j;
+        }
+    }
+    return index;
+}
+
+void putBits(inout uint4 block, inout uint offset, uint value, uint count)
+{
+    value &= (1u << count) - 1;
+    uint word = offset / 32;
+    uint bit = offset % 32;
+    block[word] |= value << bit;
+    if (bit + count > 32)
+        block[word + 1] |= value >> (32 - bit);
+    offset += count;
+}
+
+[numthreads(8, 8, 1)]
+void main(uint3 tid : SV_DispatchThreadID)
+{
+    uint3 dims;
+    TexSHCoeffs.GetDimensions(dims.x, dims.y, dims.z);
+    if (any(tid.xy >= (dims.xy + 3) / 4))
+        return;
+
+    // fetch, edge blocks repeat the last texel
+    int3 texels[16];
+    int3 min_v = 0x7FFFFFFF;
+    int3 max_v = -0x7FFFFFFF;
+    [unroll]
+    for (uint i = 0; i < 16; ++i) {
+        uint2 coord = min(tid.xy * 4 + uint2(i % 4, i / 4), dims.xy - 1);
+        texels[i] = toIntDomain(TexSHCoeffs[uint3(coord, tid.z)]);
+        min_v = min(min_v, texels[i]);
+        max_v = max(max_v, texels[i]);
+    }
+
+    // orient the box diagonal: flip channels anti-correlated with the widest one
+    int3 extent = max_v - min_v;
+    uint widest = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z ? 1 : 2);
+    float3 center = (min_v + max_v) * .5;
+    float3 cov = 0;
+    [unroll]
+    for (uint c = 0; c < 16; ++c) {
+        float3 d = texels[c] - center;
+        cov += d * d[widest];
+    }
+    int3 ep0 = (cov < 0) ? max_v : min_v;
+    int3 ep1 = (cov < 0) ? min_v : max_v;
+
+    int3 q0 = quantize(ep0);
+    int3 q1 = quantize(ep1);
+    int3 unq0 = unquantize(q0);
+    int3 unq1 = unquantize(q1);
+
+    int3 palette[16];
+    [unroll]
+    for (uint w = 0; w < 16; ++w)
+        palette[w] = finishUnquantize((unq0 * (64 - WEIGHTS[w]) + unq1 * WEIGHTS[w] + 32) >> 6);
+
+    uint indices[16];
+    [unroll]
+    for (uint k = 0; k < 16; ++k)
+        indices[k] = closestIndex(texels[k], palette);
+
+    // anchor index (texel 0) is stored with its msb implied 0
+    if (indices[0] >= 8) {
+        int3 temp = q0;
+        q0 = q1;
+        q1 = temp;
+        [unroll]
+        for (uint f = 0; f < 16; ++f)
+            indices[f] = 15 - indices[f];
+    }
+
+    uint4 block = 0;
+    uint offset = 0;
+    putBits(block, offset, MODE_11, 5);
+    putBits(block, offset, q0.r, 10);
+    putBits(block, offset, q0.g, 10);
+    putBits(block, offset, q0.b, 10);
+    putBits(block, offset, q1.r, 10);
+    putBits(block, offset, q1.g, 10);
+    putBits(block, offset, q1.b, 10);
+    putBits(block, offset, indices[0], 3);
+    [unroll]
+    for (uint b = 1; b < 16; ++b)
+        putBits(block, offset, indices[b], 4);
+
+    RWTexBlocks[tid] = block;
+}
\ No newline at end of file
@@ -6,30 +6,174 @@ cbuffer CBData : register(b0)
     float3 light_dir;
     float weight;
     uint face;
-    float3 _pad;
+    uint light_count;
+    uint slice;
+    uint faces;
+    uint2 tile_offset;
+    uint2 face_dims;
+    float prev_scale;
 };
 
-Texture2D<float> TexRadiance : register(t0);
+Texture2DArray<float> TexRadiance : register(t0);
+#ifdef FACES
+Texture2DArray<float> TexTr : register(t1);
+#else
 Texture2D<float> TexTr : register(t1);
+#endif
 RWTexture2DArray<float3> RWTexSHCoeffs : register(u0);
 
-[numthreads(8, 8, 1)] 
-void main(uint2 tid : SV_DispatchThreadID)
+// L1: first order sh, 4 coefficients in 2 slices instead of 9 in 3, see --sh-order
+// either way 3 coefficients per slice, the last slice zero padded
+#ifdef L1
+#define SH_COEFFS SH::L1
+#define SH_PROJECT SH::ProjectOntoL1
+#define SH_COUNT 4
+#define SH_SLICES 2
+#else
+#define SH_COEFFS SH::L2
+#define SH_PROJECT SH::ProjectOntoL2
+#define SH_COUNT 9
+#define SH_SLICES 3
+#endif
+
+float3 shSlice(SH_COEFFS sh, uint s)
+{
+    float3 coeffs = 0;
+    [unroll]
+    for (uint j = 0; j < 3; ++j) {
+        uint i = min(s * 3 + j, SH_COUNT - 1); // in bounds even where the branch is unrolled away
+        if (s * 3 + j < SH_COUNT)
+            coeffs[j] = sh.C[i];
+    }
+    return coeffs;
+}
+
+// BATCHED: all light directions of a set in one dispatch, accumulated in registers
+// w of each light is how many colors it stands for, weight is that of one
+// prev_scale adds them to what the coefficients hold, rescaled, see --tolerance, 0 overwrites without reading it
+#ifdef BATCHED
+StructuredBuffer<float4> LightDirs : register(t2);
+
+float3 prevCoeffs(uint3 idx)
+{
+    [branch]
+    if (prev_scale == 0)
+        return 0;
+    return RWTexSHCoeffs[idx] * prev_scale;
+}
+#endif
+
+// TILED (with BATCHED): lights go through groupshared memory a tile at a time, one light per thread of the group,
+// so each direction & its projection onto the basis is computed once per group rather than once per texel
+// GROUP_SIZE_X & GROUP_SIZE_Y set the group, the host dispatches with the same, see TILED_GROUP_SIZE
+#ifdef TILED
+#ifndef GROUP_SIZE_X
+#define GROUP_SIZE_X 16
+#endif
+#ifndef GROUP_SIZE_Y
+#define GROUP_SIZE_Y 16
+#endif
+#define LIGHT_TILE (GROUP_SIZE_X * GROUP_SIZE_Y)
+groupshared float3 gs_light_dirs[LIGHT_TILE];
+groupshared float gs_basis[SH_COUNT][LIGHT_TILE];
+#else
+#define GROUP_SIZE_X 8
+#define GROUP_SIZE_Y 8
+#endif
+
+// FACES (with BATCHED): the faces of an identifier as slices, see --group-faces
+// tid.z is the face's slot, faces holds the face of each slot in 4 bits, colors & sh slices follow one face after the other
+
+// LUT: view directions of the dispatched face or tile & the phase from lookup tables, see --phase-lut
+#ifdef LUT
+Texture2D<float4> TexViewDirs : register(t3);
+StructuredBuffer<float> PhaseLut : register(t4);
+#endif
+
+float phaseOf(float cos_theta, float tr)
+{
+#ifdef LUT
+    return Phase::MsHeuristicFromLut(PhaseLut, cos_theta, tr);
+#else
+    return Phase::MsHeuristic(cos_theta, tr);
+#endif
+}
+
+[numthreads(GROUP_SIZE_X, GROUP_SIZE_Y, 1)] 
+void main(uint3 tid : SV_DispatchThreadID, uint gidx : SV_GroupIndex)
 {
-    float color = TexRadiance[tid];
+#ifdef FACES
+    uint slice_face = (faces >> (tid.z * 4)) & 0xF;
+    uint first_light = tid.z * light_count;
+    uint first_coeff = tid.z * SH_SLICES;
+    float tr = TexTr[tid];
+#else
+    uint slice_face = face;
+    uint first_light = 0;
+    uint first_coeff = 0;
+    float tr = TexTr[tid.xy];
+#endif
+
+#ifdef LUT
+    float3 view_dir = TexViewDirs[tid.xy].xyz;
+#else
+    float2 uv = (tid.xy + tile_offset + .5) / face_dims;
+    float3 view_dir = viewDirFromFace(slice_face, uv);
+#endif
+
+#if defined(BATCHED) && defined(TILED)
+    SH_COEFFS sh = SH_COEFFS::Zero();
+    for (uint tile = 0; tile < light_count; tile += LIGHT_TILE) {
+        uint l = tile + gidx;
+        if (l < light_count) {
+            float3 dir = LightDirs[l].xyz;
+            SH_COEFFS basis = SH_PROJECT(dir, weight * LightDirs[l].w * 4 * 3.1415926);
+            gs_light_dirs[gidx] = dir;
+            [unroll]
+            for (uint k = 0; k < SH_COUNT; ++k)
+                gs_basis[k][gidx] = basis.C[k];
+        }
+        GroupMemoryBarrierWithGroupSync();
+
+        uint count = min(LIGHT_TILE, light_count - tile);
+        for (uint i = 0; i < count; ++i) {
+            float color = TexRadiance[uint3(tid.xy, first_light + tile + i)];
+            float phase = phaseOf(dot(-view_dir, gs_light_dirs[i]), tr);
+            float value = color / phase;
+            [unroll]
+            for (uint k = 0; k < SH_COUNT; ++k)
+                sh.C[k] += gs_basis[k][i] * value;
+        }
+        GroupMemoryBarrierWithGroupSync();
+    }
+
+    [unroll]
+    for (uint s = 0; s < SH_SLICES; ++s)
+        RWTexSHCoeffs[uint3(tid.xy, first_coeff + s)] = prevCoeffs(uint3(tid.xy, first_coeff + s)) + shSlice(sh, s);
+#elif defined(BATCHED)
+    SH_COEFFS sh = SH_COEFFS::Zero();
+    for (uint i = 0; i < light_count; ++i) {
+        float3 dir = LightDirs[i].xyz;
+        float color = TexRadiance[uint3(tid.xy, first_light + i)];
+        float phase = phaseOf(dot(-view_dir, dir), tr);
+        sh = SH::Add(sh, SH_PROJECT(dir, color / phase * weight * LightDirs[i].w * 4 * 3.1415926));
+    }
+
+    [unroll]
+    for (uint s = 0; s < SH_SLICES; ++s)
+        RWTexSHCoeffs[uint3(tid.xy, first_coeff + s)] = prevCoeffs(uint3(tid.xy, first_coeff + s)) + shSlice(sh, s);
+#else
+    float color = TexRadiance[uint3(tid.xy, slice)];
 
-    uint2 dims;
-    TexTr.GetDimensions(dims.x, dims.y);
-    float2 uv = (tid.xy + .5) / dims;
-    float3 view_dir = viewDirFromFace(face, uv);
     float u = dot(-view_dir, light_dir);
-    float phase = Phase::MsHeuristic(u, TexTr[tid.xy]);
+    float phase = phaseOf(u, tr);
 
     color /= phase;
 
-    SH::L2 sh = SH::ProjectOntoL2(light_dir, color * weight * 4 * 3.1415926);
+    SH_COEFFS sh = SH_PROJECT(light_dir, color * weight * 4 * 3.1415926);
 
-    RWTexSHCoeffs[uint3(tid.xy, 0)] += float3(sh.C[0], sh.C[1], sh.C[2]);
-    RWTexSHCoeffs[uint3(tid.xy, 1)] += float3(sh.C[3], sh.C[4], sh.C[5]);
-    RWTexSHCoeffs[uint3(tid.xy, 2)] += float3(sh.C[6], sh.C[7], sh.C[8]);
+    [unroll]
+    for (uint s = 0; s < SH_SLICES; ++s)
+        RWTexSHCoeffs[uint3(tid.xy, s)] += shSlice(sh, s);
+#endif
 }
\ No newline at end of file
@@ -70,6 +70,32 @@ float MsHeuristic(float cos_theta, float tr)
 
     return lerp(JendersieAt10um(cos_theta), scale, w);
 }
+
+// JendersieAt10um tabulated over sqrt((1 - cos_theta) / 2), which spreads the forward peak over many entries
+// must match JENDERSIE_LUT_SIZE in lib/baker.cpp
+static const uint JENDERSIE_LUT_SIZE = 4096;
+
+float JendersieFromLut(StructuredBuffer<float> lut, float cos_theta)
+{
+    float x = sqrt(saturate(.5 - .5 * cos_theta)) * (JENDERSIE_LUT_SIZE - 1);
+    uint i = min(uint(x), JENDERSIE_LUT_SIZE - 2);
+    return lerp(lut[i], lut[i + 1], x - i);
+}
+
+float MsHeuristicFromLut(StructuredBuffer<float> lut, float cos_theta, float tr)
+{
+    static const float scale = .25 / 3.1415926;
+    static const float power = 0.5; // lower = less isotropic
+    float w = 1 - pow(tr, power); // isotropic weight
+
+    return lerp(JendersieFromLut(lut, cos_theta), scale, w);
+}
+}
+
+// validation stats: (sum of squared errors, max abs error, sum of squared inputs, 0), see Validation.cs.hlsl (ALL)
+float4 CombineErrorStats(float4 a, float4 b)
+{
+    return float4(a.x + b.x, max(a.y, b.y), a.z + b.z, 0);
 }
 
 #endif
\ No newline at end of file
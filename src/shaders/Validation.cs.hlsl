@@ -6,15 +6,18 @@ cbuffer CBData : register(b0)
     float3 light_dir;
     float weight;
     uint face;
-    float3 _pad;
+    uint light_count;
+    uint slice;
+    uint faces;
+    uint2 tile_offset;
+    uint2 face_dims;
 };
 
 Texture2DArray<float3> TexSHCoeffs : register(t0);
 Texture2D<float> TexTr : register(t1);
-RWTexture2D<float> RWTexOut : register(u0);
 
-[numthreads(8, 8, 1)] 
-void main(uint2 tid : SV_DispatchThreadID)
+// L1 sets have 2 slices, reads past them return 0 so they evaluate as L2 with no second order, see --sh-order
+SH::L2 loadSH(uint2 tid)
 {
     float3 sh0 = TexSHCoeffs[uint3(tid.xy, 0)];
     float3 sh1 = TexSHCoeffs[uint3(tid.xy, 1)];
@@ -30,16 +33,79 @@ void main(uint2 tid : SV_DispatchThreadID)
     sh.C[6] = sh2.x;
     sh.C[7] = sh2.y;
     sh.C[8] = sh2.z;
+    return sh;
+}
+
+// radiance from dir as seen along view_dir, what the bake got as input
+float reconstruct(SH::L2 sh, float3 view_dir, float tr, float3 dir)
+{
+    float color = SH::Evaluate(sh, dir);
+    float u = dot(-view_dir, dir);
+    return color * Phase::MsHeuristic(u, tr);
+}
+
+#ifdef ALL
+// ALL: every light direction against its input, reduced to per group partials, see ValidationReduce.cs.hlsl
+StructuredBuffer<float4> LightDirs : register(t2); // xyz, see Bake.cs.hlsl
+Texture2DArray<float> TexRadiance : register(t5);
+RWStructuredBuffer<float4> RWPartials : register(u0); // [light][group]
+
+groupshared float4 gs_stats[16 * 16];
+
+[numthreads(16, 16, 1)]
+void main(uint2 tid : SV_DispatchThreadID, uint2 gid : SV_GroupID, uint gi : SV_GroupIndex)
+{
+    bool inside = all(tid < face_dims);
+    uint2 group_dims = (face_dims + 15) / 16;
+    uint group_count = group_dims.x * group_dims.y;
+
+    SH::L2 sh = loadSH(tid);
+    float2 uv = (tid.xy + tile_offset + .5) / face_dims;
+    float3 view_dir = viewDirFromFace(face, uv);
+    float tr = TexTr[tid.xy];
+
+    for (uint i = 0; i < light_count; ++i) {
+        float ref = TexRadiance[uint3(tid.xy, i)];
+        float err = reconstruct(sh, view_dir, tr, LightDirs[i].xyz) - ref;
+        gs_stats[gi] = inside ? float4(err * err, abs(err), ref * ref, 0) : 0;
+        GroupMemoryBarrierWithGroupSync();
+
+        [unroll]
+        for (uint stride = 16 * 16 / 2; stride > 0; stride >>= 1) {
+            if (gi < stride)
+                gs_stats[gi] = CombineErrorStats(gs_stats[gi], gs_stats[gi + stride]);
+            GroupMemoryBarrierWithGroupSync();
+        }
+
+        if (gi == 0)
+            RWPartials[i * group_count + gid.y * group_dims.x + gid.x] = gs_stats[0];
+    }
+}
+#else
+RWTexture2D<float> RWTexOut : register(u0);
 
-    float color = SH::Evaluate(sh, light_dir);
+// LUT: also writes the relative error of the tabulated phase the bake divided by, see --phase-lut
+#ifdef LUT
+Texture2D<float4> TexViewDirs : register(t3);
+StructuredBuffer<float> PhaseLut : register(t4);
+RWTexture2D<float> RWTexLutError : register(u1);
+#endif
 
-    uint2 dims;
-    TexTr.GetDimensions(dims.x, dims.y);
-    float2 uv = (tid.xy + .5) / dims;
+[numthreads(8, 8, 1)] 
+void main(uint2 tid : SV_DispatchThreadID)
+{
+    SH::L2 sh = loadSH(tid);
+
+    float2 uv = (tid.xy + tile_offset + .5) / face_dims;
     float3 view_dir = viewDirFromFace(face, uv);
-    float u = dot(-view_dir, light_dir);
-    float phase = Phase::MsHeuristic(u, TexTr[tid.xy]);
-    color *= phase;
+    float color = reconstruct(sh, view_dir, TexTr[tid.xy], light_dir);
 
     RWTexOut[tid.xy] = color;
-}
\ No newline at end of file
+
+#ifdef LUT
+    float phase = Phase::MsHeuristic(dot(-view_dir, light_dir), TexTr[tid.xy]);
+    float lut_u = dot(-TexViewDirs[tid.xy].xyz, light_dir);
+    RWTexLutError[tid.xy] = Phase::MsHeuristicFromLut(PhaseLut, lut_u, TexTr[tid.xy]) / phase - 1;
+#endif
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,43 @@
+#include "Common.hlsli"
+
+cbuffer CBData : register(b0)
+{
+    float3 light_dir;
+    float weight;
+    uint face;
+    uint light_count;
+    uint slice;
+    uint faces;
+    uint2 tile_offset;
+    uint2 face_dims;
+};
+
+// per group partials of Validation.cs.hlsl (ALL), one group per light
+StructuredBuffer<float4> Partials : register(t0);
+RWStructuredBuffer<float4> RWStats : register(u0);
+
+groupshared float4 gs_stats[256];
+
+[numthreads(256, 1, 1)]
+void main(uint gi : SV_GroupIndex, uint3 gid : SV_GroupID)
+{
+    uint2 group_dims = (face_dims + 15) / 16;
+    uint group_count = group_dims.x * group_dims.y;
+    uint light = gid.x;
+
+    float4 stats = 0;
+    for (uint i = gi; i < group_count; i += 256)
+        stats = CombineErrorStats(stats, Partials[light * group_count + i]);
+    gs_stats[gi] = stats;
+    GroupMemoryBarrierWithGroupSync();
+
+    [unroll]
+    for (uint stride = 256 / 2; stride > 0; stride >>= 1) {
+        if (gi < stride)
+            gs_stats[gi] = CombineErrorStats(gs_stats[gi], gs_stats[gi + stride]);
+        GroupMemoryBarrierWithGroupSync();
+    }
+
+    if (gi == 0)
+        RWStats[light] = gs_stats[0];
+}
\ No newline at end of file
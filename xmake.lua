@@ -18,13 +18,101 @@ add_rules("mode.debug", "mode.releasedbg")
 -- add requires
 add_requires("argparse", "spdlog", "re2", "directxmath", "directxtex", "directxtk")
 
+-- compiles compute shaders to bytecode headers (fxc /Fh) that get embedded in the executable
+-- files can list extra variants, each compiled once more with its macros defined to 1, "BATCHED_LUT" defines BATCHED & LUT
+-- sm6_variants are compiled with dxc to cs_6_0 instead, as g_<name>_<variant>_SM6, for --backend d3d12
+rule("hlsl.cso")
+    set_extensions(".hlsl")
+    on_load(function (target)
+        local headerdir = path.join(target:autogendir(), "rules", "hlsl")
+        if not os.isdir(headerdir) then
+            os.mkdir(headerdir)
+        end
+        target:add("includedirs", headerdir)
+    end)
+    before_buildcmd_file(function (target, batchcmds, sourcefile, opt)
+        import("lib.detect.find_tool")
+
+        -- fxc ships with the windows sdk, which is only on PATH inside the toolchain envs
+        local envs = {}
+        for _, toolchain_inst in ipairs(target:toolchains()) do
+            table.join2(envs, toolchain_inst:runenvs())
+        end
+        local fxc = assert(find_tool("fxc", {envs = envs}), "fxc not found, install the Windows SDK")
+
+        local headerdir = path.join(target:autogendir(), "rules", "hlsl")
+        local name      = path.basename(path.basename(sourcefile)) -- Bake.cs.hlsl -> Bake
+        local variants  = table.join({""}, target:fileconfig(sourcefile) and target:fileconfig(sourcefile).variants or {})
+        for _, variant in ipairs(variants) do
+            local symbol     = variant == "" and name or (name .. "_" .. variant)
+            local headerfile = path.join(headerdir, symbol .. ".cs.h")
+            local argv       = {"/nologo", "/T", "cs_5_0", "/E", "main", "/O3", "/Ges", "/Vn", "g_" .. symbol, "/Fh", headerfile}
+            for _, define in ipairs(variant:split("_")) do
+                table.insert(argv, "/D")
+                table.insert(argv, define .. "=1")
+            end
+            table.insert(argv, sourcefile)
+
+            batchcmds:show_progress(opt.progress, "${color.build.object}compiling.hlsl %s%s", sourcefile, variant == "" and "" or (" " .. variant))
+            batchcmds:vrunv(fxc.program, argv, {envs = envs})
+        end
+
+        local sm6_variants = target:fileconfig(sourcefile) and target:fileconfig(sourcefile).sm6_variants or {}
+        if #sm6_variants > 0 then
+            local dxc = assert(find_tool("dxc", {envs = envs}), "dxc not found, install the Windows SDK")
+            for _, variant in ipairs(sm6_variants) do
+                local symbol     = name .. "_" .. variant .. "_SM6"
+                local headerfile = path.join(headerdir, symbol .. ".cs.h")
+                local argv       = {"-T", "cs_6_0", "-E", "main", "-O3", "-Vn", "g_" .. symbol, "-Fh", headerfile}
+                for _, define in ipairs(variant:split("_")) do
+                    table.insert(argv, "-D")
+                    table.insert(argv, define .. "=1")
+                end
+                table.insert(argv, sourcefile)
+
+                batchcmds:show_progress(opt.progress, "${color.build.object}compiling.hlsl %s %s (sm6)", sourcefile, variant)
+                batchcmds:vrunv(dxc.program, argv, {envs = envs})
+            end
+        end
+
+        -- the shared includes are dependencies of every shader
+        local headerfile = path.join(headerdir, name .. ".cs.h")
+        batchcmds:add_depfiles(sourcefile, os.files(path.join(path.directory(sourcefile), "*.hlsli")))
+        batchcmds:set_depmtime(os.mtime(headerfile))
+        batchcmds:set_depcache(target:dependfile(headerfile))
+    end)
+rule_end()
+
 -- targets
+-- the bake internals & the in-process api of src/lib/cloud_bakery.h, the executables below link against it
+target("cloud-bakery-lib")
+    set_kind("static")
+    add_packages("argparse", "spdlog", "re2", "directxmath", "directxtex", "directxtk", {public = true})
+    add_syslinks("dxgi", "d3dcompiler", "d3d11", "d3d12", "user32", {public = true})
+    add_vectorexts("avx2") -- --backend cpu, falls back to scalar code without it
+
+    add_rules("hlsl.cso")
+    add_files("src/lib/*.cpp")
+    add_files("src/shaders/*.cs.hlsl")
+    add_files("src/shaders/Bake.cs.hlsl", {variants = {"BATCHED", "LUT", "BATCHED_LUT", "BATCHED_FACES", "L1", "LUT_L1", "BATCHED_L1", "BATCHED_LUT_L1", "BATCHED_FACES_L1"},
+                                           sm6_variants = {"BATCHED_TILED", "BATCHED_FACES_TILED", "BATCHED_TILED_L1", "BATCHED_FACES_TILED_L1"}})
+    add_files("src/shaders/Validation.cs.hlsl", {variants = {"LUT", "ALL"}})
+    add_headerfiles("src/lib/*.h")
+    add_includedirs("src", {public = true})
+    add_includedirs("src/lib", {public = true})
+
 target("cloud-bakery")
-    add_packages("argparse", "spdlog", "re2", "directxmath", "directxtex", "directxtk")
-    add_syslinks("dxgi", "d3dcompiler", "d3d11", "user32")
+    add_deps("cloud-bakery-lib")
+    add_syslinks("advapi32")
+
+    add_files("src/main.cpp")
+
+    -- sources for --shader-dir, the shaders themselves are embedded
+    add_installfiles("src/shaders/*", {prefixdir = "bin/shaders"}) 
 
-    add_files("src/**.cpp")
-    -- add_headerfiles("src/**.h")
-    add_includedirs("src")
+-- synthetic inputs, see src/bench/bench.cpp
+target("cloud-bakery-bench")
+    set_default(false)
+    add_deps("cloud-bakery-lib")
 
-    add_installfiles("src/shaders/*", {prefixdir = "bin/shaders"}) 
\ No newline at end of file
+    add_files("src/bench/bench.cpp")
\ No newline at end of file